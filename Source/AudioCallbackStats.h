@@ -0,0 +1,251 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/*
+    Timing of every audio callback: how much of its deadline it used, how
+    often it ran over, and where the time went.
+
+    The audio thread is the only writer. It brackets each callback with a
+    ScopedCallback and each stage with a ScopedStage. Every reading is a
+    relaxed atomic, updated with a plain load and store, so writing never
+    waits and never locks. Any thread can take a Snapshot at any time.
+    Counts only ever grow; readers diff two snapshots to get a rate.
+*/
+class AudioCallbackStats
+{
+public:
+    enum Stage
+    {
+        kControl, // parameter snapshots and input analysis
+        kVoices, // voice rendering and grain crossfades, envelopes included
+        kEnvelope, // CPU time in envelopes, summed over render threads
+        kLowpass,
+        kMix, // copying the mono synth to every output channel
+        kNumStages
+    };
+
+    static constexpr const char* kStageNames[kNumStages] = {
+        "control", "voices", "envelope", "lowpass", "mix"
+    };
+
+    // Budget utilisation in 10% steps to 100%, then 100-150%, 150-200%
+    // and over 200%
+    static const int kNumBuckets = 13;
+    static const int kHistorySize = 512; // blocks
+
+    struct Snapshot
+    {
+        juce::uint64 num_callbacks = 0;
+        juce::uint64 num_overruns = 0; // callbacks that took longer than their budget
+        juce::uint64 num_late = 0; // callbacks that started over twice a budget late
+        juce::uint64 histogram[kNumBuckets] = {};
+        double callback_seconds = 0.0; // total time in callbacks
+        double budget_seconds = 0.0; // total audio produced
+        double stage_seconds[kNumStages] = {};
+        double peak_utilisation = 0.0; // worst single callback, 1 = the whole budget
+    };
+
+    AudioCallbackStats() = default;
+
+    //==========================================================================
+    // Audio thread
+
+    /**
+    Times one callback of num_samples samples.
+    */
+    class ScopedCallback
+    {
+    public:
+        ScopedCallback(AudioCallbackStats& stats, int num_samples) noexcept :
+            stats_(stats),
+            num_samples_(num_samples),
+            start_(juce::Time::getHighResolutionTicks())
+        { /* Nothing */ }
+
+        ~ScopedCallback()
+        {
+            stats_.addCallback(start_, juce::Time::getHighResolutionTicks(), num_samples_);
+        }
+
+    private:
+        AudioCallbackStats& stats_;
+        const int num_samples_;
+        const juce::int64 start_;
+    };
+
+    /**
+    Adds the time until it goes out of scope to a stage. Does nothing if
+    stats is nullptr, so code that is also run offline can stay
+    instrumented.
+    */
+    class ScopedStage
+    {
+    public:
+        ScopedStage(AudioCallbackStats* stats, Stage stage) noexcept :
+            stats_(stats),
+            stage_(stage),
+            start_(stats != nullptr ? juce::Time::getHighResolutionTicks() : 0)
+        { /* Nothing */ }
+
+        ~ScopedStage()
+        {
+            if (stats_ != nullptr)
+                stats_->addStageTicks(stage_, juce::Time::getHighResolutionTicks() - start_);
+        }
+
+    private:
+        AudioCallbackStats* const stats_;
+        const Stage stage_;
+        const juce::int64 start_;
+    };
+
+    /**
+    Sets the sample rate budgets are worked out from. Call while audio is
+    stopped.
+    */
+    void prepare(double sampleRate) noexcept
+    {
+        ticks_per_sample_ = (double) juce::Time::getHighResolutionTicksPerSecond() / sampleRate;
+        last_start_ = 0;
+    }
+
+    void addStageTicks(Stage stage, juce::int64 ticks) noexcept
+    {
+        increase(stage_ticks_[stage], ticks);
+    }
+
+    //==========================================================================
+    // Readers
+
+    Snapshot getSnapshot() const noexcept
+    {
+        const double seconds_per_tick = 1.0 / (double) juce::Time::getHighResolutionTicksPerSecond();
+
+        Snapshot snapshot;
+        snapshot.num_callbacks = num_callbacks_.load(std::memory_order_relaxed);
+        snapshot.num_overruns = num_overruns_.load(std::memory_order_relaxed);
+        snapshot.num_late = num_late_.load(std::memory_order_relaxed);
+        for (int bucket = 0; bucket < kNumBuckets; ++bucket)
+            snapshot.histogram[bucket] = histogram_[bucket].load(std::memory_order_relaxed);
+        snapshot.callback_seconds = callback_ticks_.load(std::memory_order_relaxed) * seconds_per_tick;
+        snapshot.budget_seconds = budget_ticks_.load(std::memory_order_relaxed) * seconds_per_tick;
+        for (int stage = 0; stage < kNumStages; ++stage)
+        {
+            snapshot.stage_seconds[stage] =
+                stage_ticks_[stage].load(std::memory_order_relaxed) * seconds_per_tick;
+        }
+        snapshot.peak_utilisation = peak_utilisation_.load(std::memory_order_relaxed);
+        return snapshot;
+    }
+
+    /**
+    Copies the budget utilisation of up to the last num_blocks callbacks
+    into dest, oldest first. Returns the number copied.
+    */
+    int getRecentUtilisation(float* dest, int num_blocks) const noexcept
+    {
+        const juce::uint64 end = num_callbacks_.load(std::memory_order_acquire);
+        const int count = (int) juce::jmin<juce::uint64>(
+            end, (juce::uint64) juce::jmin(num_blocks, kHistorySize));
+        for (int idx = 0; idx < count; ++idx)
+        {
+            const auto block = end - (juce::uint64) count + (juce::uint64) idx;
+            dest[idx] = history_[block % kHistorySize].load(std::memory_order_relaxed);
+        }
+        return count;
+    }
+
+    /**
+    The lower edge of a histogram bucket, as a fraction of the budget.
+    */
+    static double getBucketStart(int bucket) noexcept
+    {
+        return bucket <= 10 ? bucket * 0.1 : 1.0 + (bucket - 10) * 0.5;
+    }
+
+    /**
+    The readings as one line of JSON, for logs that are compared later.
+    device_xruns is the count the audio device reports, or -1.
+    */
+    static juce::String toJSON(const Snapshot& snapshot, int device_xruns)
+    {
+        auto* stages = new juce::DynamicObject();
+        for (int stage = 0; stage < kNumStages; ++stage)
+            stages->setProperty(kStageNames[stage], snapshot.stage_seconds[stage]);
+
+        juce::Array<juce::var> histogram;
+        for (auto count : snapshot.histogram)
+            histogram.add((juce::int64) count);
+
+        auto* line = new juce::DynamicObject();
+        line->setProperty("time", juce::Time::getCurrentTime().toISO8601(true));
+        line->setProperty("callbacks", (juce::int64) snapshot.num_callbacks);
+        line->setProperty("overruns", (juce::int64) snapshot.num_overruns);
+        line->setProperty("late", (juce::int64) snapshot.num_late);
+        line->setProperty("device_xruns", device_xruns);
+        line->setProperty("callback_seconds", snapshot.callback_seconds);
+        line->setProperty("budget_seconds", snapshot.budget_seconds);
+        line->setProperty("peak_utilisation", snapshot.peak_utilisation);
+        line->setProperty("histogram", histogram);
+        line->setProperty("stage_seconds", juce::var(stages));
+        return juce::JSON::toString(juce::var(line), true);
+    }
+
+private:
+    void addCallback(juce::int64 start, juce::int64 end, int num_samples) noexcept
+    {
+        const double budget = num_samples * ticks_per_sample_;
+        const double utilisation = budget > 0.0 ? (double) (end - start) / budget : 0.0;
+
+        // A callback that starts well after the last one's budget ran out
+        // means the device was starved somewhere
+        if (last_start_ != 0 && (double) (start - last_start_) > 2.0 * last_budget_)
+            increase(num_late_, 1);
+        last_start_ = start;
+        last_budget_ = budget;
+
+        const int bucket = utilisation < 1.0
+            ? (int) (utilisation * 10.0)
+            : juce::jmin(kNumBuckets - 1, 10 + (int) ((utilisation - 1.0) * 2.0));
+        increase(histogram_[bucket], 1);
+        if (utilisation > 1.0)
+            increase(num_overruns_, 1);
+        if (utilisation > peak_utilisation_.load(std::memory_order_relaxed))
+            peak_utilisation_.store(utilisation, std::memory_order_relaxed);
+
+        increase(callback_ticks_, end - start);
+        increase(budget_ticks_, (juce::int64) budget);
+
+        const auto block = num_callbacks_.load(std::memory_order_relaxed);
+        history_[block % kHistorySize].store((float) utilisation, std::memory_order_relaxed);
+        num_callbacks_.store(block + 1, std::memory_order_release);
+    }
+
+    // Only the audio thread writes, so no read-modify-write is needed
+    template <typename Value>
+    static void increase(std::atomic<Value>& counter,
+                         std::type_identity_t<Value> amount) noexcept
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + amount,
+                      std::memory_order_relaxed);
+    }
+
+    // Audio thread only
+    double ticks_per_sample_ = 0.0;
+    juce::int64 last_start_ = 0;
+    double last_budget_ = 0.0;
+
+    std::atomic<juce::uint64> num_callbacks_ { 0 };
+    std::atomic<juce::uint64> num_overruns_ { 0 };
+    std::atomic<juce::uint64> num_late_ { 0 };
+    std::atomic<juce::uint64> histogram_[kNumBuckets] = {};
+    std::atomic<juce::int64> callback_ticks_ { 0 };
+    std::atomic<juce::int64> budget_ticks_ { 0 };
+    std::atomic<juce::int64> stage_ticks_[kNumStages] = {};
+    std::atomic<double> peak_utilisation_ { 0.0 };
+    std::atomic<float> history_[kHistorySize] = {};
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AudioCallbackStats)
+};
@@ -0,0 +1,408 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "CustomADSR.h"
+#include "SynthEngine.h"
+#include "SynthParameters.h"
+#include "VoiceBank.h"
+
+//==============================================================================
+/*
+    Times the synth's hot paths without opening a window or an audio device:
+
+        GranularSynth --bench [--quick] [--out=<results.json>]
+
+    Four suites run in turn:
+      - voice: one VoiceBank voice, across pitches (so grain overlap
+        counts), grain lengths, block sizes and the period cache.
+      - envelope: CustomADSR::getNextSample() and renderBlock() in each
+        stage.
+      - engine: SynthEngine with 1 to 128 held notes, serial and parallel.
+      - cloud: one VoiceBank voice in grain cloud mode, across densities
+        and grain lengths.
+
+    Each case is run several times and the median is reported, as
+    nanoseconds per output sample and, for block-based cases, callbacks per
+    second. Results are written as JSON, to stdout unless --out is given,
+    so runs on different commits can be compared.
+*/
+class Benchmark
+{
+public:
+    static bool isBenchCommand(const juce::StringArray& args)
+    {
+        return args.contains("--bench");
+    }
+
+    /**
+    Runs the --bench command line. Returns the process exit code.
+    */
+    static int run(const juce::StringArray& args)
+    {
+        const juce::ArgumentList arg_list("GranularSynth", args);
+
+        Benchmark benchmark(arg_list.containsOption("--quick"));
+        benchmark.runVoiceSuite();
+        benchmark.runEnvelopeSuite();
+        benchmark.runEngineSuite();
+        benchmark.runCloudSuite();
+        std::cerr << std::endl;
+
+        const auto json = juce::JSON::toString(benchmark.getReport());
+        if (!arg_list.containsOption("--out"))
+        {
+            std::cout << json << std::endl;
+            return 0;
+        }
+
+        const auto out_file = juce::File::getCurrentWorkingDirectory()
+                                  .getChildFile(arg_list.getValueForOption("--out"));
+        if (!out_file.replaceWithText(json + "\n"))
+        {
+            std::cerr << "Could not write: <" << out_file.getFullPathName() << ">" << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+private:
+    explicit Benchmark(bool quick) :
+        seconds_per_run_(quick ? 1.0 : 10.0),
+        num_runs_(quick ? 3 : kNumRuns)
+    { /* Nothing */ }
+
+    //==========================================================================
+    // Suites
+
+    void runVoiceSuite()
+    {
+        for (int grain_length : { 256, 1024, 4096 })
+        {
+            auto grain = makeGrain(grain_length);
+            for (int pitch : { 36, 60, 84, 108 })
+            {
+                for (int block_size : { 64, 256, 1024 })
+                {
+                    for (bool period_cache : { false, true })
+                    {
+                        VoiceBank voices(grain, 1, makeEnvelope(0.01f, 0.01f, 0.1f), period_cache);
+                        voices.setHighestFrequency(SynthEngine::midiToFreq(SynthEngine::kHighestNote));
+                        voices.prepareToPlay(block_size, kSampleRate);
+                        voices.setPitch(0, (float) pitch, (float) pitch);
+                        voices.noteOn(0, 1.0f);
+
+                        juce::HeapBlock<float> out((size_t) block_size);
+                        const double ns = timeBlocks(block_size, [&] {
+                            voices.renderNextBlock(out, block_size);
+                        });
+
+                        auto* result = addResult("voice", ns, block_size);
+                        result->setProperty("grain_length", grain_length);
+                        result->setProperty("pitch", pitch);
+                        result->setProperty("period_cache", period_cache);
+                        result->setProperty("peak_grains", voices.getOverlapStats().peak_num_grains);
+                        checkSink(out, block_size);
+                    }
+                }
+            }
+        }
+    }
+
+    void runEnvelopeSuite()
+    {
+        // Long stages, so the timed samples all fall inside the stage
+        const float long_stage = 1000.0f; // seconds
+        const float short_stage = 0.001f; // seconds
+        struct Stage
+        {
+            const char* name;
+            CustomADSR::Parameters envelope;
+            bool note_off; // released before timing
+        };
+        const Stage stages[] = {
+            { "attack", makeEnvelope(long_stage, short_stage, short_stage), false },
+            { "decay", makeEnvelope(short_stage, long_stage, short_stage), false },
+            { "sustain", makeEnvelope(short_stage, short_stage, short_stage), false },
+            { "release", makeEnvelope(short_stage, short_stage, long_stage), true },
+        };
+        const int settle_samples = (int) (4 * short_stage * kSampleRate);
+
+        for (const auto& stage : stages)
+        {
+            CustomADSR adsr(stage.envelope);
+            adsr.setSampleRate(kSampleRate);
+            auto startStage = [&] {
+                adsr.reset();
+                adsr.noteOn();
+                for (int idx = 0; idx < settle_samples; ++idx)
+                    adsr.getNextSample();
+                if (stage.note_off)
+                    adsr.noteOff();
+            };
+
+            startStage();
+            float sum = 0.0f;
+            const double per_sample_ns = timeSamples(startStage, [&] (int num_samples) {
+                for (int idx = 0; idx < num_samples; ++idx)
+                    sum += adsr.getNextSample();
+            });
+            checkSink(&sum, 1);
+            auto* sample_result = addResult("envelope", per_sample_ns, 0);
+            sample_result->setProperty("method", "getNextSample");
+            sample_result->setProperty("stage", stage.name);
+
+            juce::HeapBlock<float> out((size_t) kEnvelopeBlockSize);
+            startStage();
+            const double block_ns = timeSamples(startStage, [&] (int num_samples) {
+                for (int start = 0; start < num_samples; start += kEnvelopeBlockSize)
+                    adsr.renderBlock(out, juce::jmin(kEnvelopeBlockSize, num_samples - start));
+            });
+            checkSink(out, kEnvelopeBlockSize);
+            auto* block_result = addResult("envelope", block_ns, kEnvelopeBlockSize);
+            block_result->setProperty("method", "renderBlock");
+            block_result->setProperty("stage", stage.name);
+        }
+    }
+
+    void runEngineSuite()
+    {
+        auto grain = makeGrain(1024);
+        SynthParameters parameters;
+        parameters.setSampleRate(kSampleRate);
+        parameters.setAttack(0.01f);
+        parameters.pullSnapshot();
+        const auto& snapshot = parameters.getSnapshot();
+
+        for (bool parallel : { false, true })
+        {
+            for (int num_voices : { 1, 2, 4, 8, 16, 32, 64, 128 })
+            {
+                SynthEngine engine(parallel ? ParallelVoiceRenderer::getDefaultNumWorkers() : 0);
+                engine.setPolyphony(num_voices);
+                engine.setParallelRenderingEnabled(parallel);
+                engine.prepareToPlay(kEngineBlockSize, kSampleRate);
+                engine.setEnvelope(snapshot.envelope, snapshot.envelope_tables);
+                engine.loadGrain(grain, parameters.getEnvelopeParameters());
+
+                // A spread of held notes, two octaves either side of middle C,
+                // or across the whole keyboard when there are more voices than
+                // that. Past one voice per key, the notes go over several
+                // channels so each still takes a voice of its own.
+                juce::MidiBuffer notes;
+                const int num_channels = (num_voices + kNumKeys - 1) / kNumKeys;
+                const int notes_per_channel = (num_voices + num_channels - 1) / num_channels;
+                for (int voice = 0; voice < num_voices; ++voice)
+                {
+                    const int channel = 1 + voice % num_channels;
+                    const int idx = voice / num_channels;
+                    const int note = num_voices <= 48
+                        ? 36 + voice * 48 / num_voices
+                        : SynthEngine::kLowestNote + idx * kNumKeys / notes_per_channel;
+                    notes.addEvent(juce::MidiMessage::noteOn(channel, note, 0.8f), 0);
+                }
+
+                juce::AudioSampleBuffer buffer(1, kEngineBlockSize);
+                engine.renderNextBlock(buffer, notes);
+
+                const juce::MidiBuffer no_events;
+                const double ns = timeBlocks(kEngineBlockSize, [&] {
+                    engine.renderNextBlock(buffer, no_events);
+                });
+
+                auto* result = addResult("engine", ns, kEngineBlockSize);
+                result->setProperty("voices", num_voices);
+                result->setProperty("parallel", parallel);
+                checkSink(buffer.getReadPointer(0), kEngineBlockSize);
+            }
+        }
+    }
+
+    void runCloudSuite()
+    {
+        auto grain = makeGrain(1024);
+        for (float density : { 100.0f, 1000.0f, GrainCloud::kMaxDensity })
+        {
+            for (float length : { 0.01f, 0.05f })
+            {
+                VoiceBank voices(grain, 1, makeEnvelope(0.01f, 0.01f, 0.1f));
+                voices.setHighestFrequency(SynthEngine::midiToFreq(SynthEngine::kHighestNote));
+                voices.setCloudEnabled(true);
+                voices.setCloudSettings({ density, 0.02f, 0.5f, length });
+                voices.prepareToPlay(kCloudBlockSize, kSampleRate);
+                voices.setPitch(0, 60.0f, 60.0f);
+                voices.noteOn(0, 1.0f);
+
+                juce::HeapBlock<float> out((size_t) kCloudBlockSize);
+                const double ns = timeBlocks(kCloudBlockSize, [&] {
+                    voices.renderNextBlock(out, kCloudBlockSize);
+                });
+
+                auto* result = addResult("cloud", ns, kCloudBlockSize);
+                result->setProperty("density", density);
+                result->setProperty("grain_seconds", length);
+                result->setProperty("dropped_grains", voices.getOverlapStats().dropped_grains);
+                checkSink(out, kCloudBlockSize);
+            }
+        }
+    }
+
+    //==========================================================================
+    // Timing
+
+    /**
+    Median nanoseconds per sample of render_block, which renders
+    block_size samples per call.
+    */
+    template <typename RenderBlock>
+    double timeBlocks(int block_size, RenderBlock&& render_block)
+    {
+        const int blocks_per_run = juce::jmax(
+            1, (int) (seconds_per_run_ * kSampleRate / block_size));
+
+        // Untimed, so every grain pool and cache has filled
+        for (int idx = 0; idx < blocks_per_run / 4 + 1; ++idx)
+            render_block();
+
+        std::vector<double> run_ns;
+        for (int run = 0; run < num_runs_; ++run)
+        {
+            const auto start = juce::Time::getHighResolutionTicks();
+            for (int idx = 0; idx < blocks_per_run; ++idx)
+                render_block();
+            const auto ticks = juce::Time::getHighResolutionTicks() - start;
+            run_ns.push_back(juce::Time::highResolutionTicksToSeconds(ticks) * 1.0e9
+                             / ((double) blocks_per_run * block_size));
+        }
+        return median(run_ns);
+    }
+
+    /**
+    Median nanoseconds per sample of render, which renders the number of
+    samples it is given. restart runs untimed before each run.
+    */
+    template <typename Restart, typename Render>
+    double timeSamples(Restart&& restart, Render&& render)
+    {
+        const int samples_per_run = (int) (seconds_per_run_ * kSampleRate);
+
+        std::vector<double> run_ns;
+        for (int run = 0; run < num_runs_; ++run)
+        {
+            restart();
+            const auto start = juce::Time::getHighResolutionTicks();
+            render(samples_per_run);
+            const auto ticks = juce::Time::getHighResolutionTicks() - start;
+            run_ns.push_back(juce::Time::highResolutionTicksToSeconds(ticks) * 1.0e9
+                             / samples_per_run);
+        }
+        return median(run_ns);
+    }
+
+    static double median(std::vector<double> values)
+    {
+        std::sort(values.begin(), values.end());
+        return values[values.size() / 2];
+    }
+
+    /**
+    Keeps the compiler from dropping work whose output is never read.
+    */
+    void checkSink(const float* samples, int num_samples) noexcept
+    {
+        for (int idx = 0; idx < num_samples; ++idx)
+            sink_ += samples[idx];
+    }
+
+    //==========================================================================
+    // Results
+
+    /**
+    Adds a result. block_size is 0 for cases that are not block based.
+    */
+    juce::DynamicObject* addResult(const juce::String& suite, double ns_per_sample, int block_size)
+    {
+        auto* result = new juce::DynamicObject();
+        result->setProperty("suite", suite);
+        result->setProperty("ns_per_sample", ns_per_sample);
+        if (block_size > 0)
+        {
+            result->setProperty("block_size", block_size);
+            result->setProperty("callbacks_per_second", 1.0e9 / (ns_per_sample * block_size));
+        }
+        results_.add(juce::var(result));
+
+        std::cerr << "." << std::flush;
+        return result;
+    }
+
+    juce::var getReport() const
+    {
+        auto* report = new juce::DynamicObject();
+        report->setProperty("version", ProjectInfo::versionString);
+        report->setProperty("date", juce::Time::getCurrentTime().toISO8601(true));
+        report->setProperty("cpu", juce::SystemStats::getCpuModel());
+        report->setProperty("num_cpus", juce::SystemStats::getNumCpus());
+        report->setProperty("sample_rate", kSampleRate);
+        report->setProperty("seconds_per_run", seconds_per_run_);
+        report->setProperty("num_runs", num_runs_);
+        report->setProperty("results", results_);
+        return juce::var(report);
+    }
+
+    //==========================================================================
+    // Test signals
+
+    /**
+    A Hann-windowed sine of kGrainPeriods periods, like a grain cut by
+    grain-extractor, with the plain sine as its source.
+    */
+    static GrainTable::Ptr makeGrain(int grain_length)
+    {
+        juce::AudioSampleBuffer grain(1, grain_length);
+        auto* samples = grain.getWritePointer(0);
+        for (int idx = 0; idx < grain_length; ++idx)
+        {
+            const double phase = juce::MathConstants<double>::twoPi * kGrainPeriods * idx
+                / grain_length;
+            samples[idx] = (float) (std::sin(phase) + 0.3 * std::sin(2.0 * phase));
+        }
+
+        std::vector<float> window((size_t) grain_length);
+        juce::dsp::WindowingFunction<float>::fillWindowingTables(
+            window.data(),
+            (size_t) grain_length,
+            juce::dsp::WindowingFunction<float>::hann,
+            true);
+
+        return GrainTable::create(grain, window.data(),
+                                  (float) (kGrainPeriods * kSampleRate / grain_length));
+    }
+
+    /**
+    The app's envelope shapes with the given stage times.
+    */
+    static CustomADSR::Parameters makeEnvelope(float attack, float decay, float release)
+    {
+        SynthParameters parameters;
+        parameters.setAttack(attack);
+        parameters.setDecay(decay);
+        parameters.setRelease(release);
+        return parameters.getEnvelopeParameters();
+    }
+
+    static constexpr double kSampleRate = 48000.0;
+    static const int kNumRuns = 7;
+    static const int kGrainPeriods = 4;
+    static const int kEnvelopeBlockSize = 256;
+    static const int kEngineBlockSize = 512;
+    static const int kNumKeys = SynthEngine::kHighestNote - SynthEngine::kLowestNote + 1;
+    static const int kCloudBlockSize = 256;
+
+    const double seconds_per_run_; // of audio
+    const int num_runs_;
+
+    juce::Array<juce::var> results_;
+    float sink_ = 0.0f;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Benchmark)
+};
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "AudioCallbackStats.h"
+
+//==============================================================================
+/*
+    Shows how hard the audio callback is working: its load and the share of
+    each stage since the last refresh, overrun and xrun counts, a graph of
+    the latest blocks and a histogram of every block so far.
+
+    It can also append the readings to a log file as JSON lines, so load
+    spikes can be found after the fact.
+*/
+class CallbackStatsView  : public juce::Component,
+                           private juce::Timer
+{
+public:
+    CallbackStatsView(const AudioCallbackStats& stats,
+                      juce::AudioDeviceManager& device_manager) :
+        stats_(stats),
+        device_manager_(device_manager)
+    {
+        startTimerHz(kRefreshHz);
+    }
+
+    ~CallbackStatsView() override
+    {
+        stopTimer();
+    }
+
+    /**
+    Starts appending a line of readings to file every few seconds. An
+    empty File stops logging.
+    */
+    void setLogFile(const juce::File& file)
+    {
+        log_file_ = file;
+        refreshes_since_log_ = 0;
+        if (log_file_ != juce::File())
+            log_file_.getParentDirectory().createDirectory();
+    }
+
+    void paint(juce::Graphics& g) override
+    {
+        const auto text_colour = getLookAndFeel().findColour(juce::Label::textColourId);
+        auto bounds = getLocalBounds().reduced(4, 2);
+
+        drawHistogram(g, bounds.removeFromRight(kHistogramWidth), text_colour);
+        bounds.removeFromRight(4);
+        drawRecent(g, bounds.removeFromRight(kGraphWidth), text_colour);
+        bounds.removeFromRight(4);
+
+        float recent_peak = 0.0f;
+        for (int idx = 0; idx < num_recent_; ++idx)
+            recent_peak = juce::jmax(recent_peak, recent_[idx]);
+
+        juce::String load_text = "Load " + percent(load_) + " (peak " + percent(recent_peak)
+            + ")  overruns " + juce::String((juce::int64) shown_.num_overruns)
+            + "  late " + juce::String((juce::int64) shown_.num_late)
+            + "  xruns " + (device_xruns_ >= 0 ? juce::String(device_xruns_) : "-");
+
+        juce::String stage_text;
+        for (int stage = 0; stage < AudioCallbackStats::kNumStages; ++stage)
+        {
+            stage_text += juce::String(AudioCallbackStats::kStageNames[stage]) + " "
+                + percent(stage_load_[stage]) + "  ";
+        }
+
+        g.setColour(text_colour);
+        g.drawText(load_text, bounds.removeFromTop(bounds.getHeight() / 2),
+                   juce::Justification::centredLeft);
+        g.drawText(stage_text, bounds, juce::Justification::centredLeft);
+    }
+
+private:
+    void timerCallback() override
+    {
+        const auto snapshot = stats_.getSnapshot();
+
+        // Loads are over the last refresh, as a share of the audio produced
+        const double budget = snapshot.budget_seconds - shown_.budget_seconds;
+        if (budget > 0.0)
+        {
+            load_ = (float) ((snapshot.callback_seconds - shown_.callback_seconds) / budget);
+            for (int stage = 0; stage < AudioCallbackStats::kNumStages; ++stage)
+            {
+                stage_load_[stage] = (float) ((snapshot.stage_seconds[stage]
+                                               - shown_.stage_seconds[stage]) / budget);
+            }
+        }
+        shown_ = snapshot;
+        num_recent_ = stats_.getRecentUtilisation(recent_, AudioCallbackStats::kHistorySize);
+
+        device_xruns_ = -1;
+        if (auto* device = device_manager_.getCurrentAudioDevice())
+            device_xruns_ = device->getXRunCount();
+
+        repaint();
+
+        if (log_file_ != juce::File() && ++refreshes_since_log_ >= kRefreshesPerLog)
+        {
+            refreshes_since_log_ = 0;
+            log_file_.appendText(AudioCallbackStats::toJSON(snapshot, device_xruns_) + "\n");
+        }
+    }
+
+    /**
+    One column per block, newest on the right, with the budget as a line.
+    */
+    void drawRecent(juce::Graphics& g, juce::Rectangle<int> area, juce::Colour colour)
+    {
+        const float budget_y = area.getBottom() - area.getHeight() / kGraphHeadroom;
+        const int num_columns = juce::jmin(num_recent_, area.getWidth());
+        for (int column = 0; column < num_columns; ++column)
+        {
+            const float utilisation = recent_[num_recent_ - num_columns + column];
+            const float height = juce::jmin(utilisation / kGraphHeadroom, 1.0f) * area.getHeight();
+            g.setColour(utilisation > 1.0f ? juce::Colours::red : colour.withAlpha(0.6f));
+            g.fillRect((float) (area.getRight() - num_columns + column),
+                       area.getBottom() - height,
+                       1.0f,
+                       height);
+        }
+
+        g.setColour(colour.withAlpha(0.4f));
+        g.drawHorizontalLine((int) budget_y, (float) area.getX(), (float) area.getRight());
+    }
+
+    /**
+    Every block so far, by share of the budget used. Bar heights are
+    logarithmic so rare overruns still show.
+    */
+    void drawHistogram(juce::Graphics& g, juce::Rectangle<int> area, juce::Colour colour)
+    {
+        juce::uint64 most = 1;
+        for (auto count : shown_.histogram)
+            most = juce::jmax(most, count);
+
+        const float bar_width = (float) area.getWidth() / AudioCallbackStats::kNumBuckets;
+        for (int bucket = 0; bucket < AudioCallbackStats::kNumBuckets; ++bucket)
+        {
+            const auto count = shown_.histogram[bucket];
+            if (count == 0)
+                continue;
+
+            const float height = area.getHeight()
+                * (float) (std::log1p((double) count) / std::log1p((double) most));
+            g.setColour(AudioCallbackStats::getBucketStart(bucket) >= 1.0
+                            ? juce::Colours::red
+                            : colour.withAlpha(0.6f));
+            g.fillRect(area.getX() + bucket * bar_width,
+                       area.getBottom() - height,
+                       bar_width - 1.0f,
+                       height);
+        }
+    }
+
+    static juce::String percent(float fraction)
+    {
+        return juce::String(juce::roundToInt(fraction * 100.0f)) + "%";
+    }
+
+    static const int kRefreshHz = 10;
+    static const int kRefreshesPerLog = 10 * kRefreshHz; // every 10 seconds
+    static const int kGraphWidth = 200; // pixels
+    static const int kHistogramWidth = 4 * AudioCallbackStats::kNumBuckets; // pixels
+    static constexpr float kGraphHeadroom = 2.0f; // the graph's top is twice the budget
+
+    const AudioCallbackStats& stats_;
+    juce::AudioDeviceManager& device_manager_;
+
+    AudioCallbackStats::Snapshot shown_;
+    float load_ = 0.0f;
+    float stage_load_[AudioCallbackStats::kNumStages] = {};
+    float recent_[AudioCallbackStats::kHistorySize] = {};
+    int num_recent_ = 0;
+    int device_xruns_ = -1;
+
+    juce::File log_file_;
+    int refreshes_since_log_ = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CallbackStatsView)
+};
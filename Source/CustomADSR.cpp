@@ -26,6 +26,42 @@ void CustomADSR::setParameters(const CustomADSR::Parameters& newParameters)
   reset();
 }
 
+void CustomADSR::setParameters(const CustomADSR::Parameters& newParameters,
+                               const CustomADSR::Tables& tables) noexcept
+{
+  parameters_ = newParameters;
+  tables_ = tables;
+
+  // Keep the current stage and amplitude; only the slope from here on
+  // changes
+  const unsigned int last_idx = static_cast<unsigned int>(parameters_.env_resolution) - 1;
+  attack_idx_ = jmin(attack_idx_, last_idx);
+  decay_idx_ = jmin(decay_idx_, last_idx);
+  release_idx_ = jmin(release_idx_, last_idx);
+  attack_samples_ = jmin(attack_samples_, tables_.attack->table_rate - 1);
+  decay_samples_ = jmin(decay_samples_, tables_.decay->table_rate - 1);
+  release_samples_ = jmin(release_samples_, tables_.release->table_rate - 1);
+
+  switch (adsr_state_)
+  {
+    case Attack:
+      curr_attack_rate_ = (tables_.attack->rates[attack_idx_ + 1] -
+          tables_.attack->rates[attack_idx_]) * parameters_.maxAmp;
+      break;
+    case Decay:
+      curr_decay_rate_ = (tables_.decay->rates[decay_idx_ + 1] -
+          tables_.decay->rates[decay_idx_]) *
+          (parameters_.maxAmp - parameters_.sustain);
+      break;
+    case Release:
+      curr_release_rate_ = (tables_.release->rates[release_idx_ + 1] -
+          tables_.release->rates[release_idx_]) * release_start_amp_;
+      break;
+    default:
+      break;
+  }
+}
+
 void CustomADSR::setParameters(const juce::ADSR::Parameters& p)
 {
   parameters_ = CustomADSR::Parameters(p.attack, p.decay, p.sustain, p.release);
@@ -43,6 +79,11 @@ bool CustomADSR::isActive() const noexcept
   return adsr_state_ != Idle;
 }
 
+float CustomADSR::getLevel() const noexcept
+{
+  return curr_amplitude_;
+}
+
 void CustomADSR::setSampleRate(double newSampleRate) noexcept
 {
   jassert(newSampleRate > 0.0);
@@ -52,9 +93,9 @@ void CustomADSR::setSampleRate(double newSampleRate) noexcept
 
 #ifdef DEBUG
     // TODO
-    for (auto& t : {attack_env_table_, decay_env_table_, release_env_table_})
+    for (auto* t : {tables_.attack, tables_.decay, tables_.release})
     {
-        for (auto& e : t)
+        for (auto& e : t->rates)
         {
             std::cerr << std::setw(10) << std::to_string(e);
         }
@@ -158,6 +199,92 @@ float CustomADSR::getNextSample() noexcept
   return curr_amplitude_;
 }
 
+void CustomADSR::renderBlock(float* dst, int numSamples) noexcept
+{
+  int pos = 0;
+  while (pos < numSamples)
+  {
+    switch (adsr_state_)
+    {
+      case Idle:
+        curr_amplitude_ = 0.0f;
+        FloatVectorOperations::clear(dst + pos, numSamples - pos);
+        return;
+
+      case Sustain:
+        curr_amplitude_ = parameters_.sustain;
+        FloatVectorOperations::fill(dst + pos, curr_amplitude_, numSamples - pos);
+        return;
+
+      default:
+        pos += renderRamp(dst + pos, numSamples - pos);
+        break;
+    }
+  }
+}
+
+/**
+Writes the longest run of samples that share the current rate and stay
+clear of the stage's end, and returns its length. Falls back to one
+getNextSample() call at table points and stage transitions.
+*/
+int CustomADSR::renderRamp(float* dst, int numSamples) noexcept
+{
+  int tr, *es;
+  float rate, distance;
+
+  switch (adsr_state_)
+  {
+    case Attack:
+      tr = tables_.attack->table_rate;
+      es = &attack_samples_;
+      rate = curr_attack_rate_;
+      distance = parameters_.maxAmp - curr_amplitude_;
+      break;
+    case Decay:
+      tr = tables_.decay->table_rate;
+      es = &decay_samples_;
+      rate = -curr_decay_rate_;
+      distance = curr_amplitude_ - parameters_.sustain;
+      break;
+    case Release:
+      tr = tables_.release->table_rate;
+      es = &release_samples_;
+      rate = -curr_release_rate_;
+      distance = curr_amplitude_;
+      break;
+    default:
+      dst[0] = getNextSample();
+      return 1;
+  }
+
+  // The rate changes on the sample that reaches the next table point
+  int run = jmin(numSamples, tr - *es - 1);
+
+  // Stop short of the sample that would see the stage end. rate and
+  // distance are both measured towards the stage's target.
+  if (distance <= 0.0f)
+    run = 0;
+  else if (rate > 0.0f && distance / rate < (float) run + 1.0f)
+    run = (int) (distance / rate) - 1;
+
+  if (run <= 0)
+  {
+    dst[0] = getNextSample();
+    return 1;
+  }
+
+  // Plain indexed loop so the compiler can vectorise it
+  const float start = curr_amplitude_;
+  const float step = adsr_state_ == Attack ? rate : -rate;
+  for (int i = 0; i < run; ++i)
+    dst[i] = start + (float) (i + 1) * step;
+
+  curr_amplitude_ = dst[run - 1];
+  *es += run;
+  return run;
+}
+
 template <typename FloatType>
 void CustomADSR::applyEnvelopeToBuffer(AudioBuffer<FloatType>& buffer, int startSample, int numSamples)
 {
@@ -201,7 +328,7 @@ void CustomADSR::gotoState(State s) noexcept
       adsr_state_ = Attack;
       attack_samples_ = 0;
       attack_idx_ = 0;
-      curr_attack_rate_ = (attack_env_table_[1] - attack_env_table_[0]) *
+      curr_attack_rate_ = (tables_.attack->rates[1] - tables_.attack->rates[0]) *
           parameters_.maxAmp;
       break;
     case Decay:
@@ -209,7 +336,7 @@ void CustomADSR::gotoState(State s) noexcept
       decay_samples_ = 0;
       decay_idx_ = 0;
       curr_amplitude_ = fmin(parameters_.maxAmp, curr_amplitude_);
-      curr_decay_rate_ = (decay_env_table_[1] - decay_env_table_[0]) *
+      curr_decay_rate_ = (tables_.decay->rates[1] - tables_.decay->rates[0]) *
           (curr_amplitude_ - parameters_.sustain);
       break;
     case Sustain:
@@ -222,7 +349,7 @@ void CustomADSR::gotoState(State s) noexcept
       release_samples_ = 0;
       release_idx_ = 0;
       curr_amplitude_ = fmin(parameters_.maxAmp, curr_amplitude_);
-      curr_release_rate_ = (release_env_table_[1] - release_env_table_[0]) *
+      curr_release_rate_ = (tables_.release->rates[1] - tables_.release->rates[0]) *
           curr_amplitude_;
       break;
   }
@@ -236,10 +363,10 @@ void CustomADSR::gotoState(State s) noexcept
 
 void CustomADSR::calcRate(State s) noexcept
 {
-  int *tr, *es;
+  int *es;
   unsigned int *i;
   float *cr;
-  std::vector<float> *table;
+  const EnvelopeTableCache::Table *table;
   float scale;
 
   switch (s)
@@ -247,75 +374,51 @@ void CustomADSR::calcRate(State s) noexcept
     case Idle:
       return;
     case Attack:
-      tr = &attack_table_rate_;
       es = &attack_samples_;
       i = &attack_idx_;
       cr = &curr_attack_rate_;
-      table = &attack_env_table_;
+      table = tables_.attack;
       scale = parameters_.maxAmp;
       break;
     case Decay:
-      tr = &decay_table_rate_;
       es = &decay_samples_;
       i = &decay_idx_;
       cr = &curr_decay_rate_;
-      table = &decay_env_table_;
+      table = tables_.decay;
       scale = parameters_.maxAmp - parameters_.sustain;
       break;
     case Sustain:
       return;
     case Release:
-      tr = &release_table_rate_;
       es = &release_samples_;
       i = &release_idx_;
       cr = &curr_release_rate_;
-      table = &release_env_table_;
+      table = tables_.release;
       scale = release_start_amp_;
       break;
   }
 
   ++(*es);
-  if (*es >= *tr)
+  if (*es >= table->table_rate)
   {
     *es = 0;
     (*i) = (*i) < parameters_.env_resolution - 1 ? (*i) + 1 : (*i);
-    *cr = ((*table)[(*i) + 1] - (*table)[(*i)]) * scale;
+    *cr = (table->rates[(*i) + 1] - table->rates[(*i)]) * scale;
   }
 }
 
 void CustomADSR::recalculateRates() noexcept
 {
-  tabulateEnvelopes();
-
-  auto calc_table_rate = [this](float sec)
-  {
-    return (fmax(fmax(sample_rate_ * sec, 1.0f) / parameters_.env_resolution, 1.0f));
-  };
-
-  attack_table_rate_ = static_cast<int>(calc_table_rate(parameters_.attack));
-  decay_table_rate_ = static_cast<int>(calc_table_rate(parameters_.decay));
-  release_table_rate_ = static_cast<int>(calc_table_rate(parameters_.release));
-
-  // get rate of change per sample increment
-  for (int i = 0; i <= parameters_.env_resolution; ++i)
-  {
-    attack_env_table_[i] /= calc_table_rate(parameters_.attack);
-    decay_env_table_[i] /= calc_table_rate(parameters_.decay);
-    release_env_table_[i] /= calc_table_rate(parameters_.release);
-  }
-}
-
-void CustomADSR::tabulateEnvelopes()
-{
-  attack_env_table_.resize(parameters_.env_resolution + 1);
-  decay_env_table_.resize(parameters_.env_resolution + 1);
-  release_env_table_.resize(parameters_.env_resolution + 1);
-
-  for (int i = 0; i <= parameters_.env_resolution; ++i)
-  {
-    attack_env_table_[i] = parameters_.attackEnv((float) i / parameters_.env_resolution);
-    decay_env_table_[i] = parameters_.decayEnv((float) i / parameters_.env_resolution);
-    release_env_table_[i] = parameters_.releaseEnv((float) i / parameters_.env_resolution);
-  }
+  // Envelopes with the same settings share their tables
+  auto& cache = EnvelopeTableCache::getInstance();
+  const int resolution = static_cast<int>(parameters_.env_resolution);
+
+  attack_env_table_ = cache.getTable(parameters_.attackEnv, resolution,
+                                     parameters_.attack, sample_rate_);
+  decay_env_table_ = cache.getTable(parameters_.decayEnv, resolution,
+                                    parameters_.decay, sample_rate_);
+  release_env_table_ = cache.getTable(parameters_.releaseEnv, resolution,
+                                      parameters_.release, sample_rate_);
+
+  tables_ = { attack_env_table_.get(), decay_env_table_.get(), release_env_table_.get() };
 }
-
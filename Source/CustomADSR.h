@@ -11,31 +11,23 @@
 #pragma once
 
 #include "JuceHeader.h"
+#include "EnvelopeTableCache.h"
 
 class CustomADSR
 {
 public:
-  typedef std::function<float(float)> Envelope;
+  typedef EnvelopeShapes::Function Envelope;
 
   struct Parameters : public juce::ADSR::Parameters
   {
     template <int num, int den>
-    static inline Envelope EXP_GRO_ENV = [](float x)
-    {
-        return (static_cast<float>(den) / num) * std::log((std::exp(static_cast<float>(num) / den) - 1.0f) * x + 1.0f);
-    };
+    static constexpr Envelope EXP_GRO_ENV = &EnvelopeShapes::ExpGrowth<num, den>::evaluate;
 
     template <int num, int den>
-    static inline Envelope EXP_DEC_ENV = [](float x)
-    {
-        return (-static_cast<float>(den) / num) * std::log((std::exp(static_cast<float>(num) / den) - 1) * x + 1.0f) + 1.0f;
-    };
+    static constexpr Envelope EXP_DEC_ENV = &EnvelopeShapes::ExpDecay<num, den>::evaluate;
 
     template <int num, int den>
-    static inline Envelope POLY_ENV = [](float x)
-    {
-        return std::powf(x, static_cast<float>(num) / den);
-    };
+    static constexpr Envelope POLY_ENV = &EnvelopeShapes::Poly<num, den>::evaluate;
 
     Parameters() = default;
 
@@ -53,9 +45,9 @@ public:
                float sustainTimeSeconds,
                float releaseTimeSeconds,
                float maxAmplitude,
-               const Envelope& attackEnvFunc,
-               const Envelope& decayEnvFunc,
-               const Envelope& releaseEnvFunc,
+               Envelope attackEnvFunc,
+               Envelope decayEnvFunc,
+               Envelope releaseEnvFunc,
                size_t env_resolution=256)
       : juce::ADSR::Parameters(attackTimeSeconds,
                                decayTimeSeconds,
@@ -73,9 +65,20 @@ public:
 
     size_t env_resolution = 2; // number of tabulations for each envelope
     float maxAmp = 1.0f;
-    Envelope attackEnv = [](float x) { return x; },
-             decayEnv = [](float x) { return -x; },
-             releaseEnv = [](float x) { return -x; };
+    Envelope attackEnv = &EnvelopeShapes::LinearGrowth::evaluate,
+             decayEnv = &EnvelopeShapes::LinearDecay::evaluate,
+             releaseEnv = &EnvelopeShapes::LinearDecay::evaluate;
+  };
+
+  /**
+  Envelope tables owned by someone else, who keeps them alive for as long
+  as this envelope uses them.
+  */
+  struct Tables
+  {
+    const EnvelopeTableCache::Table* attack = nullptr;
+    const EnvelopeTableCache::Table* decay = nullptr;
+    const EnvelopeTableCache::Table* release = nullptr;
   };
 
   CustomADSR(const Parameters& newParameters);
@@ -84,10 +87,22 @@ public:
 
   void setParameters (const juce::ADSR::Parameters& newParameters);
 
+  /**
+  Switches to new parameters and prebuilt tables without resetting, so a
+  sounding note carries on from its current amplitude. Real-time safe.
+  tables must match newParameters and the current sample rate.
+  */
+  void setParameters (const Parameters& newParameters, const Tables& tables) noexcept;
+
   const Parameters& getParameters() const noexcept;
 
   bool isActive() const noexcept;
 
+  /**
+  The amplitude the envelope last produced.
+  */
+  float getLevel() const noexcept;
+
   void setSampleRate (double newSampleRate) noexcept;
 
   void reset() noexcept;
@@ -98,6 +113,13 @@ public:
 
   float getNextSample() noexcept;
 
+  /**
+  Writes the next numSamples envelope values to dst. Same as calling
+  getNextSample() for each sample, but each run between table points is
+  written as one linear ramp, and Sustain and Idle are a plain fill.
+  */
+  void renderBlock(float* dst, int numSamples) noexcept;
+
   template <typename FloatType>
   void applyEnvelopeToBuffer(juce::AudioBuffer<FloatType>& buffer,
                              int startSample,
@@ -117,24 +139,21 @@ private:
 
   void calcRate(State s) noexcept;
 
-  void recalculateRates() noexcept;
+  int renderRamp(float* dst, int numSamples) noexcept;
 
-  void tabulateEnvelopes();
+  void recalculateRates() noexcept;
 
   State adsr_state_ = Idle;
   Parameters parameters_;
   double sample_rate_ = 44100.0;
   float curr_amplitude_ = 0.0f;
 
-  std::vector<float> attack_env_table_, // tabulations of the envelope
-                                        // functions
-                     decay_env_table_,
-                     release_env_table_;
+  EnvelopeTableCache::TablePtr attack_env_table_, // per-sample rates, shared
+                                                 // with other envelopes
+                              decay_env_table_,
+                              release_env_table_;
 
-  int attack_table_rate_ = 1, // after how many samples to move to
-                              // the next rate
-      decay_table_rate_ = 1,
-      release_table_rate_ = 1;
+  Tables tables_; // the tables in use; the ones above unless given others
 
   int attack_samples_ = 0, // number of samples elapsed for each
                            // state; reset on state change
@@ -0,0 +1,116 @@
+#pragma once
+
+//==============================================================================
+/*
+    Envelope segment shapes for CustomADSR. Each shape is a policy struct
+    with a constexpr evaluate() over [0, 1]; only differences between
+    successive values matter, so a shape may be offset by any constant.
+
+    The math helpers here are constexpr stand-ins for std::exp and std::log,
+    which are not constexpr, so shapes can be checked at compile time.
+*/
+namespace EnvelopeShapes
+{
+    using Function = float (*)(float);
+
+    namespace detail
+    {
+        constexpr double kLn2 = 0.693147180559945309417;
+
+        constexpr double exp(double x)
+        {
+            // e^x = 2^n * e^r with |r| <= ln(2) / 2
+            const int n = (int) (x / kLn2 + (x < 0.0 ? -0.5 : 0.5));
+            const double r = x - n * kLn2;
+
+            double term = 1.0, sum = 1.0;
+            for (int k = 1; k < 16; ++k)
+            {
+                term *= r / k;
+                sum += term;
+            }
+
+            for (int k = 0; k < n; ++k)
+                sum *= 2.0;
+            for (int k = 0; k > n; --k)
+                sum *= 0.5;
+            return sum;
+        }
+
+        constexpr double log(double x)
+        {
+            // log(x) = e * ln(2) + log(m) with m in [1, 2)
+            int e = 0;
+            while (x >= 2.0) { x *= 0.5; ++e; }
+            while (x < 1.0) { x *= 2.0; --e; }
+
+            // log(m) = 2 * atanh((m - 1) / (m + 1))
+            const double y = (x - 1.0) / (x + 1.0);
+            double term = y, sum = 0.0;
+            for (int k = 1; k < 40; k += 2)
+            {
+                sum += term / k;
+                term *= y * y;
+            }
+            return e * kLn2 + 2.0 * sum;
+        }
+    }
+
+    /** Rises from 0 to 1. */
+    struct LinearGrowth
+    {
+        static constexpr float evaluate(float x) { return x; }
+    };
+
+    /** Falls from 0 to -1. */
+    struct LinearDecay
+    {
+        static constexpr float evaluate(float x) { return -x; }
+    };
+
+    /** Rises from 0 to 1, fast at first; num/den sets the curvature. */
+    template <int num, int den>
+    struct ExpGrowth
+    {
+        static constexpr float evaluate(float x)
+        {
+            constexpr double k = (double) num / den;
+            return (float) (detail::log((detail::exp(k) - 1.0) * x + 1.0) / k);
+        }
+    };
+
+    /** Falls from 1 to 0, fast at first; num/den sets the curvature. */
+    template <int num, int den>
+    struct ExpDecay
+    {
+        static constexpr float evaluate(float x)
+        {
+            return 1.0f - ExpGrowth<num, den>::evaluate(x);
+        }
+    };
+
+    /** x raised to num/den. */
+    template <int num, int den>
+    struct Poly
+    {
+        static constexpr float evaluate(float x)
+        {
+            if (x <= 0.0f)
+                return 0.0f;
+            return (float) detail::exp((double) num / den * detail::log(x));
+        }
+    };
+
+    namespace detail
+    {
+        constexpr bool approximatelyEqual(float a, float b)
+        {
+            return a - b < 1.0e-6f && b - a < 1.0e-6f;
+        }
+
+        static_assert(approximatelyEqual(ExpGrowth<4, 1>::evaluate(0.0f), 0.0f));
+        static_assert(approximatelyEqual(ExpGrowth<4, 1>::evaluate(1.0f), 1.0f));
+        static_assert(approximatelyEqual(ExpDecay<3, 1>::evaluate(1.0f), 0.0f));
+        static_assert(approximatelyEqual(Poly<1, 2>::evaluate(0.25f), 0.5f));
+    }
+}
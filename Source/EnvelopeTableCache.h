@@ -0,0 +1,124 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+#include "EnvelopeShapes.h"
+
+//==============================================================================
+/*
+    Per-sample rate tables for envelope segments, shared across the process.
+
+    A table depends only on the segment's shape, resolution, length and the
+    sample rate, so every voice with the same settings reads the same table.
+    The cache holds weak references: a table is freed once no envelope uses
+    it, and rebuilt the next time it is asked for.
+*/
+class EnvelopeTableCache
+{
+public:
+    struct Table
+    {
+        std::vector<float> rates; // resolution + 1 entries, per sample
+        int table_rate; // samples between successive entries
+    };
+
+    using TablePtr = std::shared_ptr<const Table>;
+
+    static EnvelopeTableCache& getInstance()
+    {
+        static EnvelopeTableCache instance;
+        return instance;
+    }
+
+    /**
+    Returns the table for a segment, building it on the first request.
+    Locks and may allocate, so keep it off the audio thread.
+    */
+    TablePtr getTable(EnvelopeShapes::Function shape,
+                      int resolution,
+                      float segment_seconds,
+                      double sample_rate)
+    {
+        const Key key { shape, resolution, segment_seconds, sample_rate };
+
+        const std::lock_guard<std::mutex> lock(mutex_);
+
+        auto found = tables_.find(key);
+        if (found != tables_.end())
+        {
+            if (auto table = found->second.lock())
+                return table;
+        }
+
+        removeExpiredTables();
+
+        TablePtr table = buildTable(key);
+        tables_[key] = table;
+        return table;
+    }
+
+    int getNumTables()
+    {
+        const std::lock_guard<std::mutex> lock(mutex_);
+        removeExpiredTables();
+        return (int) tables_.size();
+    }
+
+private:
+    struct Key
+    {
+        EnvelopeShapes::Function shape;
+        int resolution;
+        float segment_seconds;
+        double sample_rate;
+
+        bool operator<(const Key& other) const noexcept
+        {
+            // Built-in < on unrelated function pointers is unspecified;
+            // std::less gives them a total order
+            const std::less<EnvelopeShapes::Function> shape_less;
+            if (shape != other.shape)
+                return shape_less(shape, other.shape);
+
+            return std::tie(resolution, segment_seconds, sample_rate)
+                < std::tie(other.resolution, other.segment_seconds, other.sample_rate);
+        }
+    };
+
+    EnvelopeTableCache() = default;
+
+    static TablePtr buildTable(const Key& key)
+    {
+        // Samples per table entry, at least one
+        const float table_rate = (float) juce::jmax(
+            juce::jmax(key.sample_rate * key.segment_seconds, 1.0)
+                / key.resolution,
+            1.0);
+
+        auto table = std::make_shared<Table>();
+        table->table_rate = (int) table_rate;
+        table->rates.resize((size_t) key.resolution + 1);
+        for (int i = 0; i <= key.resolution; ++i)
+        {
+            table->rates[(size_t) i] =
+                key.shape((float) i / key.resolution) / table_rate;
+        }
+        return table;
+    }
+
+    void removeExpiredTables()
+    {
+        for (auto it = tables_.begin(); it != tables_.end();)
+        {
+            if (it->second.expired())
+                it = tables_.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    std::mutex mutex_;
+    std::map<Key, std::weak_ptr<const Table>> tables_;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (EnvelopeTableCache)
+};
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+#include "GrainTable.h"
+
+//==============================================================================
+/*
+    A library of grains packed into one file and memory-mapped read-only.
+    Grains are handed out as GrainTable views straight into the mapping, so
+    opening a bank reads only its index, and a grain's samples are paged in
+    the first time it plays.
+
+    File layout, little-endian (grain-extractor/pack_grains.py writes it):
+
+        Header      magic "GRNB", version, number of grains, index entry size
+        IndexEntry  one per grain: name, base frequency, sample rate, length
+                    and the byte offset of its samples
+        samples     per grain, windowed float32, starting on a kAlignment
+                    boundary and followed by kPadding zeros, then the same
+                    samples unwindowed, laid out the same way at
+                    GrainTable::getSourceOffset()
+*/
+class GrainBank : public juce::ReferenceCountedObject
+{
+public:
+    using Ptr = juce::ReferenceCountedObjectPtr<GrainBank>;
+
+    static constexpr juce::uint32 kVersion = 2;
+
+    /**
+    Maps a bank file. Returns nullptr if the file is missing or malformed.
+    */
+    static Ptr open(const juce::File& file)
+    {
+        auto map = std::make_unique<juce::MemoryMappedFile>(
+            file, juce::MemoryMappedFile::readOnly);
+        if (map->getData() == nullptr)
+            return nullptr;
+
+        Ptr bank = new GrainBank(std::move(map));
+        return bank->isValid() ? bank : nullptr;
+    }
+
+    int getNumGrains() const noexcept
+    {
+        return num_grains_;
+    }
+
+    juce::String getName(int grain_idx) const
+    {
+        const auto& entry = index_[grain_idx];
+        return juce::String::fromUTF8(entry.name,
+                                      (int) strnlen(entry.name, sizeof(entry.name)));
+    }
+
+    float getGrainFrequency(int grain_idx) const noexcept
+    {
+        return index_[grain_idx].grain_freq;
+    }
+
+    double getSampleRate(int grain_idx) const noexcept
+    {
+        return index_[grain_idx].sample_rate;
+    }
+
+    int getNumSamples(int grain_idx) const noexcept
+    {
+        return (int) index_[grain_idx].num_samples;
+    }
+
+    /**
+    A table that reads the grain's samples in place. The bank stays mapped
+    for as long as the table is alive.
+    */
+    GrainTable::Ptr getGrain(int grain_idx)
+    {
+        const auto& entry = index_[grain_idx];
+        const auto* data = reinterpret_cast<const float*>(getBytes() + entry.data_offset);
+        return GrainTable::createView(
+            data,
+            data + GrainTable::getSourceOffset((int) entry.num_samples),
+            (int) entry.num_samples,
+            entry.grain_freq,
+            this);
+    }
+
+private:
+    struct Header
+    {
+        char magic[4];
+        juce::uint32 version;
+        juce::uint32 num_grains;
+        juce::uint32 entry_size;
+    };
+
+    struct IndexEntry
+    {
+        char name[40]; // UTF-8, zero-padded
+        float grain_freq; // Hz
+        float sample_rate; // Hz
+        juce::uint32 num_samples;
+        juce::uint32 reserved;
+        juce::uint64 data_offset; // bytes from the start of the file
+    };
+
+    static_assert(sizeof(Header) == 16, "Header must match the file layout");
+    static_assert(sizeof(IndexEntry) == 64, "IndexEntry must match the file layout");
+
+    explicit GrainBank(std::unique_ptr<juce::MemoryMappedFile> map) :
+        map_(std::move(map))
+    { /* Nothing */ }
+
+    const char* getBytes() const noexcept
+    {
+        return static_cast<const char*>(map_->getData());
+    }
+
+    /**
+    Checks the header, and that every grain lies inside the file, is
+    aligned and has its padding. Sets up the index on success.
+    */
+    bool isValid()
+    {
+        const juce::uint64 file_size = (juce::uint64) map_->getSize();
+        if (file_size < sizeof(Header))
+            return false;
+
+        const auto* header = reinterpret_cast<const Header*>(getBytes());
+        if (std::memcmp(header->magic, "GRNB", 4) != 0 ||
+            header->version != kVersion ||
+            header->entry_size != sizeof(IndexEntry) ||
+            sizeof(Header) + (juce::uint64) header->num_grains * sizeof(IndexEntry) > file_size)
+        {
+            return false;
+        }
+
+        const auto* index = reinterpret_cast<const IndexEntry*>(getBytes() + sizeof(Header));
+        for (juce::uint32 grain_idx = 0; grain_idx < header->num_grains; ++grain_idx)
+        {
+            const auto& entry = index[grain_idx];
+            if (entry.num_samples == 0 || entry.num_samples > (juce::uint32) kMaxGrainSamples)
+                return false;
+
+            const juce::uint64 end = entry.data_offset
+                + ((juce::uint64) GrainTable::getSourceOffset((int) entry.num_samples)
+                   + entry.num_samples + GrainTable::kPadding) * sizeof(float);
+
+            if (entry.data_offset % GrainTable::kAlignment != 0 ||
+                end > file_size ||
+                !(entry.grain_freq >= 1.0f && entry.grain_freq <= 20000.0f))
+            {
+                return false;
+            }
+        }
+
+        // The mapping starts on a page boundary, so aligned offsets give
+        // aligned pointers
+        if (juce::snapPointerToAlignment(getBytes(), GrainTable::kAlignment) != getBytes())
+            return false;
+
+        index_ = index;
+        num_grains_ = (int) header->num_grains;
+        return true;
+    }
+
+    static const int kMaxGrainSamples = 1 << 24; // keeps offsets in an int
+
+    std::unique_ptr<juce::MemoryMappedFile> map_;
+    const IndexEntry* index_ = nullptr;
+    int num_grains_ = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (GrainBank)
+};
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+#include "GrainBank.h"
+#include "GrainTable.h"
+
+//==============================================================================
+/*
+    Every grain the synth can play, decoded and windowed ahead of time.
+
+    Grains are registered at startup, then startDecoding() decodes them all
+    across a thread pool. Grains from a GrainBank are already windowed and
+    are ready at once. Selecting a grain afterwards is a lookup; only a grain
+    whose decode has not finished yet makes the caller wait.
+
+    Register grains from one thread, before startDecoding(). Lookups are
+    safe from any thread after that.
+*/
+class GrainCache
+{
+public:
+    using ReaderFactory = std::function<juce::AudioFormatReader*(juce::AudioFormatManager&)>;
+
+    GrainCache(int num_threads = juce::SystemStats::getNumCpus()) :
+        decode_pool_(num_threads)
+    { /* Nothing */ }
+
+    ~GrainCache()
+    {
+        decode_pool_.removeAllJobs(true, kShutdownTimeoutMs);
+    }
+
+    //==========================================================================
+    // Registration
+
+    void addBank(GrainBank::Ptr bank)
+    {
+        for (int idx = 0; idx < bank->getNumGrains(); ++idx)
+        {
+            auto* entry = addEntry(bank->getName(idx), bank->getGrainFrequency(idx));
+            entry->table = bank->getGrain(idx);
+            entry->done.signal();
+        }
+    }
+
+    void addResource(const char* resource_name, const juce::String& name, float grain_freq)
+    {
+        addEntry(name, grain_freq)->create_reader =
+            [resource_name](juce::AudioFormatManager& format_manager)
+            {
+                int grain_size;
+                const char* grain_data =
+                    BinaryData::getNamedResource(resource_name, grain_size);
+                auto instream = std::make_unique<juce::MemoryInputStream>(
+                    (const void*) grain_data,
+                    static_cast<size_t>(grain_size),
+                    false);
+                return format_manager.createReaderFor(std::move(instream));
+            };
+    }
+
+    void addFile(const juce::File& file, const juce::String& name, float grain_freq)
+    {
+        addEntry(name, grain_freq)->create_reader =
+            [file](juce::AudioFormatManager& format_manager)
+            {
+                return format_manager.createReaderFor(file);
+            };
+    }
+
+    /**
+    Adds every WAV in folder named <name>.<base frequency>.wav, the naming
+    grain-extractor uses. Returns the number of grains added.
+    */
+    int addFolder(const juce::File& folder)
+    {
+        int num_added = 0;
+        for (const auto& file : folder.findChildFiles(juce::File::findFiles, false, "*.wav"))
+        {
+            const float grain_freq = getFrequencyFromName(file);
+            if (grain_freq <= 0.0f)
+                continue;
+
+            addFile(file,
+                    file.getFileNameWithoutExtension().upToFirstOccurrenceOf(".", false, false),
+                    grain_freq);
+            ++num_added;
+        }
+        return num_added;
+    }
+
+    /**
+    The base frequency in a grain file named <name>.<base frequency>.wav,
+    or 0 if the name does not hold one.
+    */
+    static float getFrequencyFromName(const juce::File& file)
+    {
+        const float grain_freq = file.getFileNameWithoutExtension()
+                                     .fromFirstOccurrenceOf(".", false, false)
+                                     .trimCharactersAtEnd(".")
+                                     .getFloatValue();
+        return (grain_freq < 1.0f || grain_freq > 20000.0f) ? 0.0f : grain_freq;
+    }
+
+    /**
+    Queues a decode job for every registered grain that needs one.
+    */
+    void startDecoding()
+    {
+        for (auto* entry : entries_)
+        {
+            if (entry->create_reader)
+                decode_pool_.addJob([this, entry] { decode(*entry); });
+        }
+    }
+
+    //==========================================================================
+    // Lookup
+
+    int getNumGrains() const noexcept
+    {
+        return entries_.size();
+    }
+
+    const juce::String& getName(int grain_idx) const noexcept
+    {
+        return entries_[grain_idx]->name;
+    }
+
+    float getGrainFrequency(int grain_idx) const noexcept
+    {
+        return entries_[grain_idx]->grain_freq;
+    }
+
+    bool isReady(int grain_idx) const noexcept
+    {
+        return entries_[grain_idx]->done.wait(0);
+    }
+
+    /**
+    The decoded grain, waiting for its decode if it is still running.
+    Returns nullptr if the grain could not be decoded or the wait timed out.
+    */
+    GrainTable::Ptr waitForGrain(int grain_idx, int timeout_ms = -1) const
+    {
+        auto* entry = entries_[grain_idx];
+        if (!entry->done.wait(timeout_ms))
+            return nullptr;
+        return entry->table;
+    }
+
+    /**
+    Reads the first channel of a grain, applies the Hann window the synth
+    has always used, and copies it into a table.
+    */
+    GrainTable::Ptr decodeGrain(juce::AudioFormatReader* raw_reader, float grain_freq)
+    {
+        auto reader = std::unique_ptr<juce::AudioFormatReader>(raw_reader);
+        if (reader == nullptr || reader->lengthInSamples <= 0)
+            return nullptr;
+
+        const int num_samples = (int) reader->lengthInSamples;
+        juce::AudioSampleBuffer buffer(1, num_samples);
+        reader->read(&buffer, 0, num_samples, 0, true, true);
+
+        return makeGrain(buffer, grain_freq);
+    }
+
+    /**
+    Makes a table of the first channel of grain windowed, keeping the
+    unwindowed samples as its source.
+    */
+    GrainTable::Ptr makeGrain(const juce::AudioSampleBuffer& grain, float grain_freq)
+    {
+        return GrainTable::create(grain, getWindow(grain.getNumSamples()), grain_freq);
+    }
+
+private:
+    struct Entry
+    {
+        juce::String name;
+        float grain_freq = 0.0f;
+        ReaderFactory create_reader; // empty if the table is already set
+        GrainTable::Ptr table; // written once, before done is signalled
+        juce::WaitableEvent done { true };
+    };
+
+    Entry* addEntry(const juce::String& name, float grain_freq)
+    {
+        auto* entry = entries_.add(new Entry());
+        entry->name = name;
+        entry->grain_freq = grain_freq;
+        return entry;
+    }
+
+    void decode(Entry& entry)
+    {
+        juce::AudioFormatManager format_manager;
+        format_manager.registerBasicFormats();
+
+        entry.table = decodeGrain(entry.create_reader(format_manager), entry.grain_freq);
+        if (entry.table == nullptr)
+            std::cerr << "Could not load grain: <" << entry.name << ">" << std::endl;
+
+        entry.done.signal();
+    }
+
+    /**
+    The normalised Hann window for a grain length, built the first time
+    that length is seen and shared after that.
+    */
+    const float* getWindow(int num_samples)
+    {
+        const std::lock_guard<std::mutex> lock(window_mutex_);
+
+        auto& window = windows_[num_samples];
+        if (window.empty())
+        {
+            window.resize((size_t) num_samples);
+            juce::dsp::WindowingFunction<float>::fillWindowingTables(
+                window.data(),
+                (size_t) num_samples,
+                juce::dsp::WindowingFunction<float>::hann,
+                true);
+        }
+        return window.data();
+    }
+
+    static const int kShutdownTimeoutMs = 5000;
+
+    juce::OwnedArray<Entry> entries_;
+
+    std::mutex window_mutex_;
+    std::map<int, std::vector<float>> windows_; // by grain length
+
+    juce::ThreadPool decode_pool_;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (GrainCache)
+};
@@ -0,0 +1,363 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/*
+    Asynchronous granular clouds, the alternative to pitch-synchronous
+    triggering. Each voice starts grains at its own density, each delayed
+    by a random amount up to the spray time. A grain reads the source from
+    the grain position, scattered by the spray too, at the voice's pitch,
+    for the grain length under a Hann window.
+
+    Onsets wait on a timing wheel per voice: kWheelSlots slots of
+    kSlotSamples samples, each an intrusive list of grains from a fixed
+    pool. Scheduling a grain and starting it are both constant time, so
+    cost depends on the grains sounding, not on how densely they start.
+    Voices share nothing, so they can be rendered on different threads.
+
+    A voice's clock only runs while the voice is rendered. A voice that
+    falls silent picks up where it left off when it next plays, unless
+    resetVoice() clears it for a new note.
+*/
+class GrainCloud
+{
+public:
+    struct Settings
+    {
+        float density = 50.0f; // grains per second, per voice
+        float spray = 0.02f; // seconds
+        float position = 0.5f; // 0 to 1 through the source
+        float length = 0.05f; // seconds
+    };
+
+    static constexpr float kMinDensity = 1.0f; // grains per second
+    static constexpr float kMaxDensity = 2000.0f;
+    static constexpr float kMaxSpray = 0.5f; // seconds
+    static constexpr float kMinLength = 0.005f; // seconds
+    static constexpr float kMaxLength = 0.5f;
+
+    explicit GrainCloud(int num_voices) :
+        num_voices_(num_voices),
+        grains_((size_t) (num_voices * kMaxGrains)),
+        wheels_((size_t) (num_voices * kWheelSlots), -1),
+        free_heads_((size_t) num_voices, -1),
+        active_heads_((size_t) num_voices, -1),
+        clocks_((size_t) num_voices, 0),
+        next_onsets_((size_t) num_voices, 0.0),
+        randoms_((size_t) num_voices)
+    {
+        for (int voice = 0; voice < num_voices_; ++voice)
+        {
+            randoms_[(size_t) voice].setSeed(voice + 1);
+
+            // Every grain starts out on its voice's free list
+            Grain* grains = getGrains(voice);
+            for (int grain = 0; grain < kMaxGrains; ++grain)
+                grains[grain].next = grain + 1 < kMaxGrains ? grain + 1 : -1;
+            free_heads_[(size_t) voice] = 0;
+        }
+
+        for (int idx = 0; idx <= kWindowSize; ++idx)
+        {
+            window_[idx] = 0.5f - 0.5f * std::cos(juce::MathConstants<float>::twoPi
+                                                  * idx / kWindowSize);
+        }
+    }
+
+    void prepare(double sampleRate) noexcept
+    {
+        sample_rate_ = sampleRate;
+    }
+
+    //==========================================================================
+    // Settings; safe to change from any thread while voices render
+
+    void setEnabled(bool enabled) noexcept
+    {
+        enabled_.store(enabled);
+    }
+
+    bool isEnabled() const noexcept
+    {
+        return enabled_.load();
+    }
+
+    void setSettings(const Settings& settings) noexcept
+    {
+        density_.store(juce::jlimit(kMinDensity, kMaxDensity, settings.density));
+        spray_.store(juce::jlimit(0.0f, kMaxSpray, settings.spray));
+        position_.store(juce::jlimit(0.0f, 1.0f, settings.position));
+        length_.store(juce::jlimit(kMinLength, kMaxLength, settings.length));
+    }
+
+    /**
+    Drops every grain of a voice, waiting or sounding, and restarts its
+    clock, so a new note starts with an empty cloud. Must not run while the
+    voice is being rendered.
+    */
+    void resetVoice(int voice) noexcept
+    {
+        // Only the grains in use are visited, so this costs no more than
+        // rendering them would
+        Grain* grains = getGrains(voice);
+        auto release = [&](int& head)
+        {
+            while (head >= 0)
+            {
+                const int released = head;
+                head = grains[released].next;
+                grains[released].next = free_heads_[(size_t) voice];
+                free_heads_[(size_t) voice] = released;
+            }
+        };
+
+        release(active_heads_[(size_t) voice]);
+        int* wheel = wheels_.data() + voice * kWheelSlots;
+        for (int slot = 0; slot < kWheelSlots; ++slot)
+            release(wheel[slot]);
+
+        clocks_[(size_t) voice] = 0;
+        next_onsets_[(size_t) voice] = 0.0;
+    }
+
+    //==========================================================================
+    // Rendering
+
+    /**
+    Adds the next num_samples of a voice's cloud to dst. source holds
+    table_size unwindowed samples followed by at least one more, and is read
+    in a loop at rate samples per output sample. Grains that start in this
+    block take source and keep reading it until they end, so the caller
+    keeps the samples valid for up to kMaxLength. Returns the number of
+    grains that could not start because the voice's pool was full.
+    */
+    int render(int voice,
+               float* dst,
+               int num_samples,
+               const float* source,
+               int table_size,
+               float rate) noexcept
+    {
+        // Short chunks keep grains from being scheduled far ahead of their
+        // onsets, which the pool is sized for
+        int dropped = 0;
+        for (int start = 0; start < num_samples; start += kSlotSamples)
+        {
+            dropped += renderChunk(voice, dst + start,
+                                   juce::jmin(kSlotSamples, num_samples - start),
+                                   source, table_size, rate);
+        }
+        return dropped;
+    }
+
+    int renderChunk(int voice,
+                    float* dst,
+                    int num_samples,
+                    const float* source,
+                    int table_size,
+                    float rate) noexcept
+    {
+        const juce::int64 now = clocks_[(size_t) voice];
+        const juce::int64 end = now + num_samples;
+        clocks_[(size_t) voice] = end;
+
+        const float density = density_.load();
+        const float length_seconds = length_.load();
+        const int length = juce::jmax(1, (int) (length_seconds * sample_rate_));
+
+        // Onsets must land within one turn of the wheel
+        const int max_delay = kWheelSlots * kSlotSamples - num_samples - kSlotSamples;
+        const int spray = juce::jlimit(0, juce::jmax(0, max_delay),
+                                       (int) (spray_.load() * sample_rate_));
+        const float position = position_.load() * table_size;
+
+        int dropped = 0;
+
+        // Every onset on the voice's regular grid that falls in this block
+        // goes on the wheel, delayed by up to the spray
+        auto& random = randoms_[(size_t) voice];
+        double& next_onset = next_onsets_[(size_t) voice];
+        next_onset = juce::jmax(next_onset, (double) now);
+        const double interval = sample_rate_ / density;
+        for (; next_onset < (double) end; next_onset += interval)
+        {
+            int delay = 0;
+            float phase = position;
+            if (spray > 0)
+            {
+                delay = random.nextInt(spray + 1);
+                phase += (random.nextFloat() - 0.5f) * (float) spray * rate;
+            }
+            if (!schedule(voice, (juce::int64) next_onset + delay,
+                          wrap(phase, (float) table_size), length))
+                ++dropped;
+        }
+
+        startDueGrains(voice, now, end, source);
+
+        // A grain's loudness adds up with the grains it overlaps
+        const float gain = 1.0f / std::sqrt(juce::jmax(1.0f, density * length_seconds));
+
+        Grain* grains = getGrains(voice);
+        int* link = &active_heads_[(size_t) voice];
+        while (*link >= 0)
+        {
+            Grain& grain = grains[*link];
+            const int start = (int) juce::jmax<juce::int64>(0, grain.onset - now);
+            const int stop = (int) juce::jmin<juce::int64>(num_samples,
+                                                           grain.onset + grain.length - now);
+
+            const float window_step = (float) kWindowSize / grain.length;
+            float window_pos = (float) (now + start - grain.onset) * window_step;
+            const float* grain_source = grain.source;
+            float phase = grain.phase;
+            for (int idx = start; idx < stop; ++idx)
+            {
+                const int read = (int) phase;
+                const float frac = phase - (float) read;
+                const float sample = grain_source[read]
+                                     + frac * (grain_source[read + 1] - grain_source[read]);
+                dst[idx] += sample * window_[(int) window_pos] * gain;
+
+                window_pos += window_step;
+                phase += rate;
+                while (phase >= (float) table_size)
+                    phase -= (float) table_size;
+            }
+            grain.phase = phase;
+
+            if (grain.onset + grain.length <= end)
+            {
+                // Finished; back to the free list
+                const int finished = *link;
+                *link = grain.next;
+                grain.next = free_heads_[(size_t) voice];
+                free_heads_[(size_t) voice] = finished;
+            }
+            else
+            {
+                link = &grain.next;
+            }
+        }
+
+        return dropped;
+    }
+
+private:
+    struct Grain
+    {
+        juce::int64 onset = 0; // on the voice's clock
+        const float* source = nullptr; // set when the grain starts
+        float phase = 0.0f; // read position in the source
+        int length = 0; // samples
+        int next = -1; // next grain in the same list
+    };
+
+    Grain* getGrains(int voice) noexcept
+    {
+        return grains_.data() + voice * kMaxGrains;
+    }
+
+    /**
+    Puts a grain on the wheel slot holding onset. Returns false if the
+    voice has no free grain.
+    */
+    bool schedule(int voice, juce::int64 onset, float phase, int length) noexcept
+    {
+        const int idx = free_heads_[(size_t) voice];
+        if (idx < 0)
+            return false;
+
+        Grain& grain = getGrains(voice)[idx];
+        free_heads_[(size_t) voice] = grain.next;
+
+        grain.onset = onset;
+        grain.phase = phase;
+        grain.length = length;
+
+        int& slot = wheels_[(size_t) (voice * kWheelSlots + getSlot(onset))];
+        grain.next = slot;
+        slot = idx;
+        return true;
+    }
+
+    /**
+    Moves every grain due before end from the wheel to the active list,
+    reading source. Only the slots the block covers are visited.
+    */
+    void startDueGrains(int voice,
+                        juce::int64 now,
+                        juce::int64 end,
+                        const float* source) noexcept
+    {
+        Grain* grains = getGrains(voice);
+        int* wheel = wheels_.data() + voice * kWheelSlots;
+        int& active_head = active_heads_[(size_t) voice];
+
+        const juce::int64 last_tick = (end - 1) / kSlotSamples;
+        for (juce::int64 tick = now / kSlotSamples; tick <= last_tick; ++tick)
+        {
+            int* link = &wheel[tick % kWheelSlots];
+            while (*link >= 0)
+            {
+                Grain& grain = grains[*link];
+                if (grain.onset >= end)
+                {
+                    link = &grain.next;
+                    continue;
+                }
+
+                const int started = *link;
+                *link = grain.next;
+                grain.source = source;
+                grain.next = active_head;
+                active_head = started;
+            }
+        }
+    }
+
+    static int getSlot(juce::int64 onset) noexcept
+    {
+        return (int) ((onset / kSlotSamples) % kWheelSlots);
+    }
+
+    static float wrap(float phase, float table_size) noexcept
+    {
+        phase = std::fmod(phase, table_size);
+        return phase < 0.0f ? phase + table_size : phase;
+    }
+
+    // Onsets are scheduled up to a chunk of kSlotSamples ahead, which is
+    // within this at any rate from about 5 kHz up
+    static constexpr float kMaxScheduleAhead = 0.05f; // seconds
+
+    // Per voice, waiting and sounding: enough that no setting drops grains
+    static const int kMaxGrains =
+        (int) (kMaxDensity * (kMaxSpray + kMaxLength + kMaxScheduleAhead));
+    static const int kSlotSamples = 256;
+    static const int kWheelSlots = 256; // a turn is about 1.4 s at 48 kHz
+    static const int kWindowSize = 512;
+
+    const int num_voices_;
+    double sample_rate_ = 48000.0;
+
+    std::atomic<bool> enabled_ { false };
+    std::atomic<float> density_ { Settings().density };
+    std::atomic<float> spray_ { Settings().spray };
+    std::atomic<float> position_ { Settings().position };
+    std::atomic<float> length_ { Settings().length };
+
+    // Per voice; grains_ and wheels_ hold a block for each voice
+    std::vector<Grain> grains_;
+    std::vector<int> wheels_; // first waiting grain in each slot, or -1
+    std::vector<int> free_heads_;
+    std::vector<int> active_heads_;
+    std::vector<juce::int64> clocks_; // samples rendered
+    std::vector<double> next_onsets_; // next onset on the regular grid
+    std::vector<juce::Random> randoms_;
+
+    float window_[kWindowSize + 1]; // Hann, shared
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (GrainCloud)
+};
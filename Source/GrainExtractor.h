@@ -0,0 +1,245 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/*
+    Cuts a grain out of an arbitrary recording: detects its pitch, then
+    picks the run of a few periods that repeats most cleanly. This is the
+    method grain-extractor/make_grains.py uses, without an FFT per candidate.
+
+    Candidates start at zero crossings and are scored by their strongest
+    autocorrelation near the period. For each lag in that range, one running
+    sum of x[i] * x[i + lag] over the whole sound gives every candidate's
+    autocorrelation at that lag with a single subtraction. Selection then
+    costs O(lags * N) in total, instead of O(crossings * N log N).
+
+    Allocates and runs an FFT, so call extract() from a worker thread.
+*/
+class GrainExtractor
+{
+public:
+    struct Settings
+    {
+        float min_freq = 200.0f; // Hz, pitch search range
+        float max_freq = 1000.0f; // Hz
+        float threshold = 0.7f; // autocorrelation peak needed, relative to lag 0
+        float freq_tolerance = 20.0f; // Hz either side of the pitch when scoring grains
+        int num_periods = 4; // grain length
+        double skip_seconds = 1.0; // skipped past the attack, if the sound is long enough
+        double analysis_seconds = 0.5; // searched for a grain
+    };
+
+    struct Grain
+    {
+        juce::AudioSampleBuffer samples; // one channel, normalised, not windowed
+        float grain_freq = 0.0f; // Hz
+        float periodicity = 0.0f; // 1 for a perfectly periodic grain
+    };
+
+    GrainExtractor() = default;
+
+    explicit GrainExtractor(const Settings& settings) :
+        settings_(settings)
+    { /* Nothing */ }
+
+    /**
+    Extracts a grain from the first channel of reader. Returns false if the
+    sound has no clear pitch in range, or is too short to hold a grain.
+    */
+    bool extract(juce::AudioFormatReader& reader, Grain& grain) const
+    {
+        const double sample_rate = reader.sampleRate;
+        const juce::int64 total_length = reader.lengthInSamples;
+        if (sample_rate <= 0.0 || total_length <= 0)
+            return false;
+
+        const juce::int64 length = juce::jmin(
+            total_length, (juce::int64) (settings_.analysis_seconds * sample_rate));
+        const juce::int64 start = juce::jlimit<juce::int64>(
+            0, total_length - length, (juce::int64) (settings_.skip_seconds * sample_rate));
+
+        juce::AudioSampleBuffer sound(1, (int) length);
+        reader.read(&sound, 0, (int) length, start, true, false);
+
+        return extract(sound.getReadPointer(0), (int) length, sample_rate, grain);
+    }
+
+    bool extract(const float* sound,
+                 int num_samples,
+                 double sample_rate,
+                 Grain& grain) const
+    {
+        const auto normalised = normalise(sound, num_samples);
+
+        const float pitch = detectPitch(normalised.data(), num_samples, sample_rate);
+        if (pitch <= 0.0f)
+            return false;
+
+        const int grain_length = (int) (settings_.num_periods * sample_rate / pitch);
+        float periodicity = 0.0f;
+        const int grain_start = findMostPeriodic(normalised.data(),
+                                                 num_samples,
+                                                 sample_rate,
+                                                 pitch,
+                                                 grain_length,
+                                                 periodicity);
+        if (grain_start < 0)
+            return false;
+
+        grain.samples.setSize(1, grain_length);
+        grain.samples.copyFrom(0, 0, normalised.data() + grain_start, grain_length);
+        grain.grain_freq = pitch;
+        grain.periodicity = periodicity;
+        return true;
+    }
+
+    /**
+    The pitch of sound in Hz, from the highest autocorrelation peak in the
+    search range. Returns 0 if that peak is below the threshold.
+    */
+    float detectPitch(const float* sound, int num_samples, double sample_rate) const
+    {
+        const int min_lag = juce::jmax(1, (int) (sample_rate / settings_.max_freq));
+        const int max_lag = (int) (sample_rate / settings_.min_freq);
+        if (max_lag + 1 >= num_samples)
+            return 0.0f;
+
+        // Zero-padded to twice the length, so the circular autocorrelation
+        // the FFT gives is the linear one
+        const int order = (int) std::ceil(std::log2(2.0 * num_samples));
+        juce::dsp::FFT fft(order);
+        std::vector<float> autocorr((size_t) fft.getSize() * 2, 0.0f);
+        std::copy(sound, sound + num_samples, autocorr.begin());
+
+        fft.performRealOnlyForwardTransform(autocorr.data(), true);
+        for (int bin = 0; bin <= fft.getSize() / 2; ++bin)
+        {
+            const float re = autocorr[(size_t) (2 * bin)];
+            const float im = autocorr[(size_t) (2 * bin + 1)];
+            autocorr[(size_t) (2 * bin)] = re * re + im * im;
+            autocorr[(size_t) (2 * bin + 1)] = 0.0f;
+        }
+        fft.performRealOnlyInverseTransform(autocorr.data());
+
+        int peak_lag = min_lag;
+        for (int lag = min_lag + 1; lag <= max_lag; ++lag)
+        {
+            if (autocorr[(size_t) lag] > autocorr[(size_t) peak_lag])
+                peak_lag = lag;
+        }
+        if (!(autocorr[(size_t) peak_lag] > settings_.threshold * autocorr[0]))
+            return 0.0f;
+
+        // A parabola through the peak and its neighbours places it between samples
+        const float before = autocorr[(size_t) peak_lag - 1];
+        const float peak = autocorr[(size_t) peak_lag];
+        const float after = autocorr[(size_t) peak_lag + 1];
+        const float curvature = before - 2.0f * peak + after;
+        const float offset = curvature < 0.0f
+            ? juce::jlimit(-0.5f, 0.5f, 0.5f * (before - after) / curvature)
+            : 0.0f;
+
+        return (float) (sample_rate / (peak_lag + offset));
+    }
+
+private:
+    /**
+    Maps the sound's range onto [-1, 1], as make_grains.py does.
+    */
+    static std::vector<float> normalise(const float* sound, int num_samples)
+    {
+        std::vector<float> normalised(sound, sound + num_samples);
+        const auto range = juce::FloatVectorOperations::findMinAndMax(sound, num_samples);
+        if (range.getLength() > 0.0f)
+        {
+            for (auto& sample : normalised)
+                sample = 2.0f * (sample - range.getStart()) / range.getLength() - 1.0f;
+        }
+        return normalised;
+    }
+
+    static int sign(float sample) noexcept
+    {
+        return (sample > 0.0f) - (sample < 0.0f);
+    }
+
+    /**
+    The start of the grain_length run, beginning at a zero crossing, with
+    the strongest autocorrelation within freq_tolerance of the pitch.
+    Returns -1 if there is no such run.
+    */
+    int findMostPeriodic(const float* sound,
+                         int num_samples,
+                         double sample_rate,
+                         float pitch,
+                         int grain_length,
+                         float& periodicity) const
+    {
+        const int min_lag = juce::jmax(
+            1, (int) (sample_rate / (pitch + settings_.freq_tolerance)));
+        const int max_lag = juce::jmin(
+            grain_length - 1,
+            (int) (sample_rate / juce::jmax(pitch - settings_.freq_tolerance, 1.0f)));
+
+        std::vector<int> starts;
+        for (int i = 0; i + grain_length <= num_samples && i + 1 < num_samples; ++i)
+        {
+            if (sign(sound[i]) != sign(sound[i + 1]))
+                starts.push_back(i);
+        }
+        if (starts.empty() || min_lag > max_lag)
+            return -1;
+
+        // sums[i] is the sum of sound[j] * sound[j + lag] for j < i, so a
+        // candidate's autocorrelation at lag is the difference of two entries
+        std::vector<double> sums((size_t) num_samples + 1);
+
+        std::vector<double> energy(starts.size());
+        runningSum(sound, num_samples, 0, sums);
+        for (size_t c = 0; c < starts.size(); ++c)
+            energy[c] = sums[(size_t) (starts[c] + grain_length)] - sums[(size_t) starts[c]];
+
+        std::vector<double> strongest(starts.size(), 0.0);
+        for (int lag = min_lag; lag <= max_lag; ++lag)
+        {
+            runningSum(sound, num_samples, lag, sums);
+            for (size_t c = 0; c < starts.size(); ++c)
+            {
+                const double autocorr = sums[(size_t) (starts[c] + grain_length - lag)]
+                    - sums[(size_t) starts[c]];
+                strongest[c] = juce::jmax(strongest[c], autocorr);
+            }
+        }
+
+        int best_start = -1;
+        double best_periodicity = 0.0;
+        for (size_t c = 0; c < starts.size(); ++c)
+        {
+            if (energy[c] <= 0.0)
+                continue;
+
+            const double candidate_periodicity = strongest[c] / energy[c];
+            if (candidate_periodicity > best_periodicity)
+            {
+                best_periodicity = candidate_periodicity;
+                best_start = starts[c];
+            }
+        }
+
+        periodicity = (float) best_periodicity;
+        return best_start;
+    }
+
+    static void runningSum(const float* sound,
+                           int num_samples,
+                           int lag,
+                           std::vector<double>& sums) noexcept
+    {
+        sums[0] = 0.0;
+        for (int i = 0; i + lag < num_samples; ++i)
+            sums[(size_t) i + 1] = sums[(size_t) i] + (double) sound[i] * sound[i + lag];
+    }
+
+    Settings settings_;
+};
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/*
+    A windowed grain and the frequency it was recorded at. Immutable once
+    created, and shared between every voice that plays it.
+
+    Alongside the windowed samples a table can keep the source they were
+    windowed from, for grain clouds, which cut their own grains from it at
+    any offset and window those themselves.
+
+    The samples are cache-line aligned and followed by kPadding zeros, so a
+    vector load that runs past the last sample reads silence. A table either
+    owns its samples or views memory kept alive by another object, such as
+    a memory-mapped GrainBank.
+*/
+class GrainTable : public juce::ReferenceCountedObject
+{
+public:
+    using Ptr = juce::ReferenceCountedObjectPtr<GrainTable>;
+
+    static constexpr int kAlignment = 64; // bytes
+    static constexpr int kPadding = 16; // samples
+
+    /**
+    Copies the first channel of grain, already windowed, into a new table.
+    The windowed samples double as the source.
+    */
+    static Ptr create(const juce::AudioSampleBuffer& grain, float grain_freq)
+    {
+        Ptr table = new GrainTable(grain.getNumSamples(), grain_freq, false);
+        juce::FloatVectorOperations::copy(table->getStorage(),
+                                          grain.getReadPointer(0),
+                                          grain.getNumSamples());
+        return table;
+    }
+
+    /**
+    Copies the first channel of source into a new table as the source, and
+    multiplied by window as the grain. window holds one gain per sample.
+    */
+    static Ptr create(const juce::AudioSampleBuffer& source,
+                      const float* window,
+                      float grain_freq)
+    {
+        const int num_samples = source.getNumSamples();
+        Ptr table = new GrainTable(num_samples, grain_freq, true);
+        juce::FloatVectorOperations::multiply(table->getStorage(),
+                                              source.getReadPointer(0),
+                                              window,
+                                              num_samples);
+        juce::FloatVectorOperations::copy(table->getStorage() + getSourceOffset(num_samples),
+                                          source.getReadPointer(0),
+                                          num_samples);
+        return table;
+    }
+
+    /**
+    Wraps samples without copying them. data and source must each be
+    kAlignment-aligned and followed by kPadding zeros, and stay valid while
+    owner is alive; the table keeps a reference to owner. source may be
+    data itself.
+    */
+    static Ptr createView(const float* data,
+                          const float* source,
+                          int num_samples,
+                          float grain_freq,
+                          juce::ReferenceCountedObject* owner)
+    {
+        jassert(juce::snapPointerToAlignment(data, kAlignment) == data);
+        jassert(juce::snapPointerToAlignment(source, kAlignment) == source);
+        return new GrainTable(data, source, num_samples, grain_freq, owner);
+    }
+
+    /**
+    Where a grain's source starts, in samples from the start of the grain,
+    when the two are stored back to back: after the grain and its padding,
+    rounded up to kAlignment.
+    */
+    static int getSourceOffset(int num_samples) noexcept
+    {
+        const int alignment = kAlignment / (int) sizeof(float);
+        return (num_samples + kPadding + alignment - 1) / alignment * alignment;
+    }
+
+    ~GrainTable() override
+    {
+        if (owner_ != nullptr)
+            owner_->decReferenceCount();
+    }
+
+    const float* getReadPointer() const noexcept
+    {
+        return data_;
+    }
+
+    /**
+    The samples before windowing, getNumSamples() of them followed by
+    kPadding zeros.
+    */
+    const float* getSourcePointer() const noexcept
+    {
+        return source_;
+    }
+
+    int getNumSamples() const noexcept
+    {
+        return num_samples_;
+    }
+
+    float getGrainFrequency() const noexcept
+    {
+        return grain_freq_;
+    }
+
+private:
+    GrainTable(int num_samples, float grain_freq, bool separate_source) :
+        num_samples_(num_samples),
+        grain_freq_(grain_freq)
+    {
+        const int source_offset = getSourceOffset(num_samples);
+        storage_.calloc((size_t) (separate_source ? source_offset + num_samples + kPadding
+                                                  : num_samples + kPadding)
+                        + kAlignment / sizeof(float));
+        data_ = getStorage();
+        source_ = separate_source ? data_ + source_offset : data_;
+    }
+
+    GrainTable(const float* data,
+               const float* source,
+               int num_samples,
+               float grain_freq,
+               juce::ReferenceCountedObject* owner) :
+        owner_(owner),
+        data_(data),
+        source_(source),
+        num_samples_(num_samples),
+        grain_freq_(grain_freq)
+    {
+        owner_->incReferenceCount();
+    }
+
+    float* getStorage() const noexcept
+    {
+        return juce::snapPointerToAlignment(storage_.get(), kAlignment);
+    }
+
+    juce::HeapBlock<float> storage_; // empty for a view
+    juce::ReferenceCountedObject* owner_ = nullptr; // holds a reference
+    const float* data_ = nullptr;
+    const float* source_ = nullptr; // data_ unless kept apart
+    int num_samples_;
+    float grain_freq_;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (GrainTable)
+};
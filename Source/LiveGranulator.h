@@ -0,0 +1,225 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+#include "GrainCloud.h"
+#include "GrainTable.h"
+
+//==============================================================================
+/*
+    Cuts grains from the audio input as it arrives.
+
+    The input is written into a ring buffer. Once per hop, the last few
+    periods at the detected pitch are cut from it, starting on a rising zero
+    crossing. They are resampled to a fixed grain length and Hann windowed
+    like any other grain, with the unwindowed samples kept as its source.
+    Every live grain has the same length and base frequency, so a VoiceBank
+    built on getGrainTable() can switch to a new one with
+    VoiceBank::setGrainData() without being rebuilt.
+
+    Grains are written into kNumSlots slots in turn, and hops are long
+    enough that a slot is only overwritten once GrainCloud::kMaxLength has
+    passed since it was cut, so no grain reading it is left in flight. The
+    slots are allocated once and never move, so a bank reading them stays
+    valid across prepare(). Everything after prepare() runs on the
+    audio thread, with no allocation or locks.
+*/
+class LiveGranulator
+{
+public:
+    static const int kGrainLength = 1024; // samples, after resampling
+    static const int kPeriodsPerGrain = 4;
+
+    /**
+    The samples of one cut grain, each followed by kPadding zeros.
+    */
+    struct Grain
+    {
+        const float* data = nullptr; // windowed
+        const float* source = nullptr;
+    };
+
+    LiveGranulator()
+    {
+        // A slot holds a grain and its source, laid out like a GrainTable
+        const int slot_size = GrainTable::getSourceOffset(kGrainLength)
+                              + kGrainLength + GrainTable::kPadding;
+        slot_storage_.calloc((size_t) (kNumSlots * slot_size)
+                             + GrainTable::kAlignment / sizeof(float));
+        auto* first_slot = juce::snapPointerToAlignment(slot_storage_.get(),
+                                                        GrainTable::kAlignment);
+        for (int slot = 0; slot < kNumSlots; ++slot)
+            slots_[slot] = first_slot + slot * slot_size;
+
+        window_.calloc((size_t) kGrainLength);
+        juce::dsp::WindowingFunction<float>::fillWindowingTables(
+            window_.get(),
+            (size_t) kGrainLength,
+            juce::dsp::WindowingFunction<float>::hann,
+            true);
+    }
+
+    /**
+    Sizes the input buffers for sampleRate. The silent table that live
+    voices are built on is only replaced if the rate changed, since the
+    grain frequency depends on it. Allocates; call while audio is stopped.
+    */
+    void prepare(double sampleRate)
+    {
+        const bool rate_changed = sampleRate != sample_rate_;
+        sample_rate_ = sampleRate;
+
+        // The slots cover kMaxLength at up to kMaxSampleRate; above that,
+        // hops get longer instead
+        min_hop_ = juce::jmax(kGrainLength, (int) std::ceil(
+            GrainCloud::kMaxLength * sampleRate / (kNumSlots - 1)));
+
+        // Room for the longest grain, plus the period searched for its start
+        const int longest_grain = (int) std::ceil(
+            (kPeriodsPerGrain + 1) * sampleRate / kMinFrequency);
+        ring_size_ = juce::nextPowerOfTwo(longest_grain + 2);
+        ring_mask_ = ring_size_ - 1;
+        ring_.calloc((size_t) ring_size_);
+        write_pos_ = 0;
+        num_written_ = 0;
+
+        cut_.calloc((size_t) longest_grain + 1);
+
+        if (rate_changed)
+        {
+            juce::AudioSampleBuffer silence(1, kGrainLength);
+            silence.clear();
+            grain_table_ = GrainTable::create(silence, getGrainFrequency());
+        }
+
+        samples_since_cut_ = 0;
+    }
+
+    /**
+    The table live voices are built on, silent until the first grain is cut.
+    Changes only in prepare(), so other threads take a copy while audio is
+    running rather than reading it later.
+    */
+    const GrainTable::Ptr& getGrainTable() const noexcept
+    {
+        return grain_table_;
+    }
+
+    /**
+    The frequency every live grain plays at: kPeriodsPerGrain periods in
+    kGrainLength samples.
+    */
+    float getGrainFrequency() const noexcept
+    {
+        return (float) (kPeriodsPerGrain * sample_rate_ / kGrainLength);
+    }
+
+    /**
+    Writes input samples into the ring buffer. Audio thread only.
+    */
+    void processInput(const float* input, int num_samples) noexcept
+    {
+        if (ring_size_ == 0)
+            return;
+
+        while (num_samples > 0)
+        {
+            const int len = juce::jmin(num_samples, ring_size_ - write_pos_);
+            juce::FloatVectorOperations::copy(ring_ + write_pos_, input, len);
+            write_pos_ = (write_pos_ + len) & ring_mask_;
+            input += len;
+            num_samples -= len;
+            num_written_ = juce::jmin(num_written_ + len, ring_size_);
+            samples_since_cut_ = juce::jmin(samples_since_cut_ + len, min_hop_);
+        }
+    }
+
+    /**
+    Cuts a new grain if a hop has passed and the input has a pitch. Returns
+    the grain's samples, which stay unchanged until GrainCloud::kMaxLength
+    after the next cut, or null pointers if there is no new grain. Audio
+    thread only.
+    */
+    Grain cutGrain(float input_freq) noexcept
+    {
+        if (ring_size_ == 0 || samples_since_cut_ < min_hop_)
+            return {};
+        if (!(input_freq >= kMinFrequency && input_freq <= kMaxFrequency))
+            return {};
+
+        const float period = (float) (sample_rate_ / input_freq);
+        const int cut_length = juce::roundToInt(kPeriodsPerGrain * period);
+        const int search_length = (int) period;
+        if (cut_length + search_length + 2 > num_written_)
+            return {};
+
+        // The latest rising zero crossing that still leaves a whole grain
+        const int latest_start = write_pos_ - cut_length - 1;
+        int start = latest_start;
+        for (int back = 0; back < search_length; ++back)
+        {
+            const int idx = latest_start - back;
+            if (ring_[(idx - 1) & ring_mask_] <= 0.0f && ring_[idx & ring_mask_] > 0.0f)
+            {
+                start = idx;
+                break;
+            }
+        }
+
+        float* cut = cut_.get();
+        for (int idx = 0; idx <= cut_length; ++idx)
+            cut[idx] = ring_[(start + idx) & ring_mask_];
+
+        // Linear interpolation is enough here; the grain is windowed after
+        float* grain = slots_[next_slot_];
+        const float step = (float) cut_length / kGrainLength;
+        for (int idx = 0; idx < kGrainLength; ++idx)
+        {
+            const float pos = idx * step;
+            const int before = (int) pos;
+            const float frac = pos - (float) before;
+            grain[idx] = cut[before] + frac * (cut[before + 1] - cut[before]);
+        }
+
+        const auto range = juce::FloatVectorOperations::findMinAndMax(grain, kGrainLength);
+        const float peak = juce::jmax(std::abs(range.getStart()), std::abs(range.getEnd()));
+        if (peak > 0.0f)
+            juce::FloatVectorOperations::multiply(grain, 1.0f / peak, kGrainLength);
+        float* source = grain + GrainTable::getSourceOffset(kGrainLength);
+        juce::FloatVectorOperations::copy(source, grain, kGrainLength);
+        juce::FloatVectorOperations::multiply(grain, window_.get(), kGrainLength);
+
+        next_slot_ = (next_slot_ + 1) % kNumSlots;
+        samples_since_cut_ = 0;
+        return { grain, source };
+    }
+
+private:
+    static constexpr float kMinFrequency = 50.0f; // Hz
+    static constexpr float kMaxFrequency = 2000.0f; // Hz
+    static constexpr double kMaxSampleRate = 192000.0;
+
+    // Enough that a slot outlives the longest cloud grain cut from it
+    static const int kNumSlots =
+        (int) (GrainCloud::kMaxLength * kMaxSampleRate / kGrainLength) + 2;
+
+    double sample_rate_ = 0.0; // until prepare()
+
+    juce::HeapBlock<float> ring_; // the latest input, circular
+    int ring_size_ = 0; // a power of two
+    int ring_mask_ = 0;
+    int write_pos_ = 0;
+    int num_written_ = 0; // up to ring_size_
+    int samples_since_cut_ = 0;
+    int min_hop_ = kGrainLength; // samples
+
+    juce::HeapBlock<float> cut_; // the cut periods, before resampling
+    juce::HeapBlock<float> window_; // kGrainLength
+    juce::HeapBlock<float> slot_storage_; // allocated once
+    float* slots_[kNumSlots] = {}; // aligned, grain then source
+    int next_slot_ = 0;
+
+    GrainTable::Ptr grain_table_;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LiveGranulator)
+};
@@ -7,7 +7,9 @@
 */
 
 #include <JuceHeader.h>
+#include "Benchmark.h"
 #include "MainComponent.h"
+#include "OfflineRenderer.h"
 
 //==============================================================================
 class GranularSynthApplication  : public juce::JUCEApplication
@@ -25,6 +27,21 @@ public:
     {
         // This method is where you should put your application's initialisation code..
 
+        // Offline renders and benchmarks run headless and quit when done
+        const auto args = getCommandLineParameterArray();
+        if (OfflineRenderer::isRenderCommand(args))
+        {
+            setApplicationReturnValue(OfflineRenderer::run(args));
+            quit();
+            return;
+        }
+        if (Benchmark::isBenchCommand(args))
+        {
+            setApplicationReturnValue(Benchmark::run(args));
+            quit();
+            return;
+        }
+
         mainWindow.reset (new MainWindow (getApplicationName()));
     }
 
@@ -7,6 +7,13 @@ MainComponent::MainComponent() : audioSetupComp (deviceManager, 0, 0, 0, 256,
                                                  true,
                                                  false)
 {
+    synth_.setCallbackStats(&callback_stats_);
+    synth_.setPolyphony(SynthEngine::getDefaultPolyphony());
+    synth_.setGrainReloader([this]
+    {
+        grain_loader_.addJob([this] { synth_.reloadLatestGrain(); });
+    });
+
     // Some platforms require permissions to open input channels so request that here
     if (juce::RuntimePermissions::isRequired (juce::RuntimePermissions::recordAudio)
         && ! juce::RuntimePermissions::isGranted (juce::RuntimePermissions::recordAudio))
@@ -21,36 +28,42 @@ MainComponent::MainComponent() : audioSetupComp (deviceManager, 0, 0, 0, 256,
     }
 
     deviceManager.addMidiInputDeviceCallback({}, this);
-    deviceManager.addChangeListener(this);
-    lpfs_.resize(num_chans.toInt64());
 
     addAndMakeVisible(audioSetupComp);
+    addAndMakeVisible(keyboard_);
 
     attack_.setSliderStyle(juce::Slider::SliderStyle::RotaryHorizontalVerticalDrag);
     attack_.setRange(0.0, 5.0);
-    attack_.setValue(0.1);
+    const auto settings = parameters_.getSettings();
+
+    attack_.setValue(settings.attack);
     attack_.setTextBoxStyle(juce::Slider::TextBoxBelow, true, 50, 10);
     decay_.setSliderStyle(juce::Slider::SliderStyle::RotaryHorizontalVerticalDrag);
     decay_.setRange(0.0, 5.0);
-    decay_.setValue(0.1);
+    decay_.setValue(settings.decay);
     decay_.setTextBoxStyle(juce::Slider::TextBoxBelow, true, 50, 10);
     sustain_.setSliderStyle(juce::Slider::SliderStyle::RotaryHorizontalVerticalDrag);
     sustain_.setRange(0.0, 1.0);
-    sustain_.setValue(0.9);
+    sustain_.setValue(settings.sustain);
     sustain_.setTextBoxStyle(juce::Slider::TextBoxBelow, true, 50, 10);
     release_.setSliderStyle(juce::Slider::SliderStyle::RotaryHorizontalVerticalDrag);
     release_.setRange(0.0, 5.0);
-    release_.setValue(0.1);
+    release_.setValue(settings.release);
     release_.setTextBoxStyle(juce::Slider::TextBoxBelow, true, 50, 10);
+    glide_.setSliderStyle(juce::Slider::SliderStyle::RotaryHorizontalVerticalDrag);
+    glide_.setRange(0.0, 2.0);
+    glide_.setValue(0.0);
+    glide_.setTextBoxStyle(juce::Slider::TextBoxBelow, true, 50, 10);
 
     cutoff_.setSliderStyle(juce::Slider::SliderStyle::LinearBar);
     cutoff_.setRange(10.0, 20000.0);
-    cutoff_.setValue(1000.0);
+    cutoff_.setValue(settings.cutoff);
 
     addAndMakeVisible(attack_);
     addAndMakeVisible(decay_);
     addAndMakeVisible(sustain_);
     addAndMakeVisible(release_);
+    addAndMakeVisible(glide_);
 
     addAndMakeVisible(cutoff_);
 
@@ -58,9 +71,54 @@ MainComponent::MainComponent() : audioSetupComp (deviceManager, 0, 0, 0, 256,
     decay_.addListener(this);
     sustain_.addListener(this);
     release_.addListener(this);
+    glide_.addListener(this);
 
     cutoff_.addListener(this);
 
+    const GrainCloud::Settings cloud_settings;
+    cloud_density_.setRange(GrainCloud::kMinDensity, GrainCloud::kMaxDensity);
+    cloud_density_.setSkewFactorFromMidPoint(cloud_settings.density);
+    cloud_density_.setValue(cloud_settings.density);
+    cloud_density_.setTextValueSuffix(" grains/s");
+    cloud_spray_.setRange(0.0, GrainCloud::kMaxSpray);
+    cloud_spray_.setValue(cloud_settings.spray);
+    cloud_spray_.setTextValueSuffix(" s spray");
+    cloud_position_.setRange(0.0, 1.0);
+    cloud_position_.setValue(cloud_settings.position);
+    cloud_position_.setTextValueSuffix(" position");
+    cloud_length_.setRange(GrainCloud::kMinLength, GrainCloud::kMaxLength);
+    cloud_length_.setValue(cloud_settings.length);
+    cloud_length_.setTextValueSuffix(" s long");
+    for (auto* slider : {&cloud_density_, &cloud_spray_, &cloud_position_, &cloud_length_})
+    {
+        slider->setSliderStyle(juce::Slider::SliderStyle::LinearBar);
+        addAndMakeVisible(slider);
+        slider->addListener(this);
+    }
+    addAndMakeVisible(cloud_toggle_);
+    cloud_toggle_.addListener(this);
+
+    addAndMakeVisible(period_cache_toggle_);
+    period_cache_toggle_.addListener(this);
+    addAndMakeVisible(parallel_toggle_);
+    parallel_toggle_.addListener(this);
+    addAndMakeVisible(mpe_toggle_);
+    mpe_toggle_.addListener(this);
+    addAndMakeVisible(follow_input_toggle_);
+    follow_input_toggle_.addListener(this);
+    addAndMakeVisible(pitch_detector_);
+    addAndMakeVisible(stats_view_);
+    addAndMakeVisible(stats_log_toggle_);
+    stats_log_toggle_.addListener(this);
+
+    steal_dropdown_.addItem("Steal oldest", (int) VoiceAllocator::StealMode::oldest + 1);
+    steal_dropdown_.addItem("Steal quietest", (int) VoiceAllocator::StealMode::quietest + 1);
+    steal_dropdown_.addItem("Retrigger same note", (int) VoiceAllocator::StealMode::sameNote + 1);
+    steal_dropdown_.setSelectedId((int) VoiceAllocator::StealMode::oldest + 1,
+                                  juce::dontSendNotification);
+    addAndMakeVisible(steal_dropdown_);
+    steal_dropdown_.addListener(this);
+
     setupBuiltinGrains();
 
     // Make sure you set the size of the component after
@@ -70,9 +128,36 @@ MainComponent::MainComponent() : audioSetupComp (deviceManager, 0, 0, 0, 256,
 
 void MainComponent::setupBuiltinGrains()
 {
-    grain_dropdown_.addItem("Custom Grain", 1);
+    grain_dropdown_.addItem("Custom Grain", kFileGrainId);
+    grain_dropdown_.addItem("Live Input", kLiveGrainId);
     grain_dropdown_.addSeparator();
 
+    // A packed bank shipped next to the app replaces the compiled-in grains
+    auto grain_bank = GrainBank::open(juce::File::getSpecialLocation(
+        juce::File::currentExecutableFile).getSiblingFile(kGrainBankFileName));
+    if (grain_bank != nullptr)
+        grain_cache_.addBank(grain_bank);
+    else
+        addBuiltinGrains();
+
+    grain_cache_.addFolder(juce::File::getSpecialLocation(
+        juce::File::userApplicationDataDirectory).getChildFile(kUserGrainFolder));
+
+    for (int idx = 0; idx < grain_cache_.getNumGrains(); ++idx)
+    {
+        grain_dropdown_.addItem(grain_cache_.getName(idx), idx + kBuiltinGrainIdOffset);
+    }
+
+    // Decode everything in the background, so picking a grain later is
+    // just a lookup
+    grain_cache_.startDecoding();
+
+    addAndMakeVisible(&grain_dropdown_);
+    grain_dropdown_.addListener(this);
+}
+
+void MainComponent::addBuiltinGrains()
+{
     for (int idx = 0; idx < BinaryData::namedResourceListSize; ++idx)
     {
         const char* rname = BinaryData::namedResourceList[idx];
@@ -105,18 +190,14 @@ void MainComponent::setupBuiltinGrains()
             continue;
         }
 
-        builtin_grains_.push_back({rname, freq});
-        grain_dropdown_.addItem(grain_name, idx + kBuiltinGrainIdOffset);
-        fprintf(stderr, "HERE\n");
+        grain_cache_.addResource(rname, grain_name, freq);
     }
-
-    addAndMakeVisible(&grain_dropdown_);
-    grain_dropdown_.addListener(this);
 }
 
 MainComponent::~MainComponent()
 {
     deviceManager.removeMidiInputDeviceCallback ({}, this);
+    grain_loader_.removeAllJobs(true, kLoaderTimeoutMs);
     // This shuts down the audio device and clears the audio source.
     shutdownAudio();
 }
@@ -126,32 +207,89 @@ void MainComponent::prepareToPlay (int samplesPerBlockExpected, double sampleRat
 {
     samples_per_block_ = samplesPerBlockExpected;
     sample_rate_ = sampleRate;
-    if (synth_)
-        synth_->prepareToPlay(samplesPerBlockExpected, sampleRate);
-    for (auto& lpf : lpfs_)
-    {
-        lpf.setCoefficients(
-            juce::IIRCoefficients::makeLowPass(sampleRate, kDefaultCutoff));
-    }
+    parameters_.setSampleRate(sampleRate);
+    callback_stats_.prepare(sampleRate);
+    synth_.prepareToPlay(samplesPerBlockExpected, sampleRate);
+    pitch_detector_.prepare(sampleRate);
+    const auto* live_table = live_granulator_.getGrainTable().get();
+    live_granulator_.prepare(sampleRate);
+    if (live_grain_enabled_.load() && live_granulator_.getGrainTable().get() != live_table)
+        loadLiveGrain(); // rebuilt on the new table
 }
 
 void MainComponent::getNextAudioBlock (const juce::AudioSourceChannelInfo& bufferToFill)
 {
-    if (synth_)
+    const AudioCallbackStats::ScopedCallback callback(callback_stats_, bufferToFill.numSamples);
+
     {
-        synth_->getNextAudioBlock(bufferToFill);
-        for (int i = 0; i < bufferToFill.buffer->getNumChannels(); ++i)
+        const AudioCallbackStats::ScopedStage stage(&callback_stats_, AudioCallbackStats::kControl);
+
+        // Voices still being rendered from the last block keep the old
+        // snapshot until they are done
+        if (synth_.isReadyForParameters() && parameters_.pullSnapshot())
+        {
+            const auto& snapshot = parameters_.getSnapshot();
+            lpf_.setCoefficients(snapshot.lowpass);
+            synth_.setEnvelope(snapshot.envelope, snapshot.envelope_tables);
+        }
+
+        // The input channel arrives in the buffer the synth is about to fill.
+        // Its pitch is only tracked while something uses it, and tracking
+        // starts afresh each time it is switched on
+        const bool track_pitch = follow_input_.load() || live_grain_enabled_.load();
+        if (track_pitch != pitch_tracking_)
+        {
+            pitch_detector_.reset();
+            pitch_tracking_ = track_pitch;
+        }
+        if (track_pitch)
         {
-            lpfs_[i].processSamples(bufferToFill.buffer->getWritePointer(i),
-                                    bufferToFill.numSamples);
+            pitch_detector_.processInput(
+                bufferToFill.buffer->getReadPointer(0, bufferToFill.startSample),
+                bufferToFill.numSamples);
+        }
+        synth_.setFollowedPitch(follow_input_.load() ? pitch_detector_.getMidiPitch() : -1.0f);
+
+        if (live_grain_enabled_.load())
+        {
+            live_granulator_.processInput(
+                bufferToFill.buffer->getReadPointer(0, bufferToFill.startSample),
+                bufferToFill.numSamples);
+
+            // A new grain only goes in between renders, like a parameter snapshot
+            if (synth_.isReadyForParameters())
+            {
+                const auto grain = live_granulator_.cutGrain(pitch_detector_.getFrequency());
+                if (grain.data != nullptr)
+                {
+                    synth_.setLiveGrainData(live_granulator_.getGrainTable().get(),
+                                            grain.data, grain.source);
+                }
+            }
         }
     }
+
+    // Everything up to the output is a single mono bus, so it is rendered
+    // and filtered once whatever the channel count
+    auto* mono = bufferToFill.buffer->getWritePointer(0, bufferToFill.startSample);
+    synth_.renderMonoBlock(mono, bufferToFill.numSamples);
+
+    {
+        const AudioCallbackStats::ScopedStage stage(&callback_stats_, AudioCallbackStats::kLowpass);
+        lpf_.processSamples(mono, bufferToFill.numSamples);
+    }
+
+    // Fan out to the device's channels last; per-channel stages such as
+    // panning belong after this
+    const AudioCallbackStats::ScopedStage stage(&callback_stats_, AudioCallbackStats::kMix);
+    SynthEngine::copyToAllChannels(*bufferToFill.buffer,
+                                   bufferToFill.startSample,
+                                   bufferToFill.numSamples);
 }
 
 void MainComponent::releaseResources()
 {
-    if (synth_)
-        synth_->releaseResources();
+    synth_.releaseResources();
 }
 
 //==============================================================================
@@ -165,188 +303,192 @@ void MainComponent::resized()
 {
     auto local_bounds = getLocalBounds();
 
-    if (synth_)
-        synth_->setBounds(local_bounds.removeFromBottom(kKeyboardHeight));
-    else
-        (void) local_bounds.removeFromBottom(kKeyboardHeight);
+    keyboard_.setBounds(local_bounds.removeFromBottom(kKeyboardHeight));
 
     auto slider_bounds = local_bounds.removeFromBottom(kSliderHeight);
-    for (auto* slider : {&attack_, &decay_, &sustain_, &release_})
+    for (auto* slider : {&attack_, &decay_, &sustain_, &release_, &glide_})
     {
         slider->setBounds(slider_bounds.removeFromLeft(kSliderWidth));
     }
 
     cutoff_.setBounds(local_bounds.removeFromBottom(kCutoffHeight));
-    grain_dropdown_.setBounds(local_bounds.removeFromTop(kDropdownHeight));
+    auto input_bounds = local_bounds.removeFromBottom(kInputHeight);
+    follow_input_toggle_.setBounds(input_bounds.removeFromRight(kToggleWidth));
+    pitch_detector_.setBounds(input_bounds);
+    auto stats_bounds = local_bounds.removeFromBottom(kStatsHeight);
+    stats_log_toggle_.setBounds(stats_bounds.removeFromRight(kToggleWidth));
+    stats_view_.setBounds(stats_bounds);
+    auto cloud_bounds = local_bounds.removeFromBottom(kCloudHeight);
+    cloud_toggle_.setBounds(cloud_bounds.removeFromRight(kToggleWidth));
+    const int cloud_slider_width = cloud_bounds.getWidth() / 4;
+    for (auto* slider : {&cloud_density_, &cloud_spray_, &cloud_position_, &cloud_length_})
+    {
+        slider->setBounds(cloud_bounds.removeFromLeft(cloud_slider_width));
+    }
+    auto dropdown_bounds = local_bounds.removeFromTop(kDropdownHeight);
+    mpe_toggle_.setBounds(dropdown_bounds.removeFromRight(kToggleWidth / 2));
+    steal_dropdown_.setBounds(dropdown_bounds.removeFromRight(kToggleWidth));
+    parallel_toggle_.setBounds(dropdown_bounds.removeFromRight(kToggleWidth));
+    period_cache_toggle_.setBounds(dropdown_bounds.removeFromRight(kToggleWidth));
+    grain_dropdown_.setBounds(dropdown_bounds);
 
     audioSetupComp.setBounds(local_bounds);
 }
 
 void MainComponent::sliderValueChanged(juce::Slider* slider)
 {
-    if (synth_)
+    // The audio thread picks these up at the start of its next block
+    if (slider == &attack_)
     {
-        if (slider == &attack_)
-        {
-            for (auto* voice : synth_->getVoices())
-            {
-                voice->setAttack(attack_.getValue());
-            }
-        }
-        else if (slider == &decay_)
-        {
-            for (auto* voice : synth_->getVoices())
-            {
-                voice->setDecay(decay_.getValue());
-            }
-        }
-        else if (slider == &sustain_)
-        {
-            for (auto* voice : synth_->getVoices())
-            {
-                voice->setSustain(sustain_.getValue());
-            }
-        }
-        else if (slider == &release_)
+        parameters_.setAttack(attack_.getValue());
+    }
+    else if (slider == &decay_)
+    {
+        parameters_.setDecay(decay_.getValue());
+    }
+    else if (slider == &sustain_)
+    {
+        parameters_.setSustain(sustain_.getValue());
+    }
+    else if (slider == &release_)
+    {
+        parameters_.setRelease(release_.getValue());
+    }
+    else if (slider == &cutoff_)
+    {
+        parameters_.setCutoff(cutoff_.getValue());
+    }
+    else if (slider == &glide_)
+    {
+        synth_.setGlideTime(glide_.getValue());
+    }
+    else if (slider == &cloud_density_ || slider == &cloud_spray_
+             || slider == &cloud_position_ || slider == &cloud_length_)
+    {
+        synth_.setCloudSettings({ (float) cloud_density_.getValue(),
+                                  (float) cloud_spray_.getValue(),
+                                  (float) cloud_position_.getValue(),
+                                  (float) cloud_length_.getValue() });
+    }
+}
+
+void MainComponent::buttonClicked(juce::Button* button)
+{
+    if (button == &period_cache_toggle_)
+    {
+        synth_.setPeriodCacheEnabled(period_cache_toggle_.getToggleState());
+    }
+    else if (button == &parallel_toggle_)
+    {
+        synth_.setParallelRenderingEnabled(parallel_toggle_.getToggleState());
+    }
+    else if (button == &cloud_toggle_)
+    {
+        synth_.setCloudEnabled(cloud_toggle_.getToggleState());
+    }
+    else if (button == &mpe_toggle_)
+    {
+        synth_.setMPEEnabled(mpe_toggle_.getToggleState());
+    }
+    else if (button == &follow_input_toggle_)
+    {
+        follow_input_.store(follow_input_toggle_.getToggleState());
+    }
+    else if (button == &stats_log_toggle_)
+    {
+        stats_view_.setLogFile(stats_log_toggle_.getToggleState()
+            ? juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
+                  .getChildFile(kStatsLogFile)
+            : juce::File());
+    }
+}
+
+bool MainComponent::isInterestedInFileDrag(const StringArray& files)
+{
+    return files.size() == 1;
+}
+
+void MainComponent::filesDropped(const StringArray& files, int /**/, int /**/)
+{
+    const juce::File sample_file(files[0]);
+    juce::Component::SafePointer<MainComponent> safe_this(this);
+
+    // Finding the pitch and the grain happens on the loader thread
+    grain_loader_.addJob([this, safe_this, sample_file]
+    {
+        juce::AudioFormatManager format_manager;
+        format_manager.registerBasicFormats();
+        std::unique_ptr<juce::AudioFormatReader> reader(
+            format_manager.createReaderFor(sample_file));
+
+        GrainExtractor::Grain grain;
+        const bool extracted = reader != nullptr
+            && GrainExtractor().extract(*reader, grain);
+        if (extracted)
         {
-            for (auto* voice : synth_->getVoices())
-            {
-                voice->setRelease(release_.getValue());
-            }
+            synth_.loadGrain(grain_cache_.makeGrain(grain.samples, grain.grain_freq),
+                             parameters_.getEnvelopeParameters());
         }
-        else if (slider == &cutoff_)
-        {
-            for (auto& lpf : lpfs_)
+
+        juce::MessageManager::callAsync(
+            [safe_this, extracted, sample_name = sample_file.getFileNameWithoutExtension()]
             {
-                lpf.setCoefficients(
-                    juce::IIRCoefficients::makeLowPass(sample_rate_, slider->getValue()));
-            }
-        }
-    }
+                if (safe_this != nullptr)
+                    safe_this->grainDropCallback(extracted, sample_name);
+            });
+    });
 }
 
-//bool MainComponent::isInterestedInFileDrag(const StringArray& files)
-//{
-//    return files.size() == 1;
-//}
-
-//void MainComponent::filesDropped(const StringArray& files, int /**/, int /**/)
-//{
-//    grain_filepath_.clear();
-//    grain_filepath_ = files[0];
-//
-//   AlertWindow::showAsync (MessageBoxOptions()
-//                          .withIconType (MessageBoxIconType::QuestionIcon)
-//                          .withTitle ("Enter a grain frequency")
-//                          .withButton ("OK")
-//                          .withButton ("Cancel"), [this](int retval){ grainDropCallback(retval); });
-//}
-
-void MainComponent::changeListenerCallback(ChangeBroadcaster* source)
+void MainComponent::grainDropCallback(bool extracted, const juce::String& sample_name)
 {
-    juce::BigInteger curr_num_chans;
-    if (source == &deviceManager &&
-        (curr_num_chans = deviceManager.getAudioDeviceSetup().outputChannels) != num_chans)
+    if (!extracted)
     {
-        num_chans = curr_num_chans;
-        lpfs_.resize(num_chans.toInt64());
+        juce::AlertWindow::showAsync(MessageBoxOptions()
+                                        .withIconType(MessageBoxIconType::WarningIcon)
+                                        .withTitle("Could not find a grain")
+                                        .withMessage(sample_name + " has no clear pitch")
+                                        .withButton("OK"), nullptr);
+        return;
     }
+    grain_dropdown_.changeItemText(kFileGrainId, "Custom Grain: " + sample_name);
+    grain_dropdown_.setSelectedId(kFileGrainId, juce::dontSendNotification);
 }
 
-//void MainComponent::grainDropCallback(int retval)
-//{
-//    if (retval == 1)
-//    {
-//        // float grain_freq = std::stof(alert_window_.getTextEditorContents("Grain Frequency").toStdString());
-//        float grain_freq = 440.0;
-//        juce::File grain_file(grain_filepath_);
-//        if (!resetSynth(&grain_file, grain_freq))
-//        {
-//            juce::AlertWindow::showAsync(MessageBoxOptions()
-//                                            .withIconType(MessageBoxIconType::WarningIcon)
-//                                            .withTitle("Could not load grain")
-//                                            .withButton("OK"), nullptr);
-//            return;
-//        }
-//        grain_dropdown_.setSelectedId(kFileGrainId);
-//    }
-//}
-
 void MainComponent::comboBoxChanged(ComboBox* comboBoxThatHasChanged)
 {
-    if (comboBoxThatHasChanged == &grain_dropdown_)
+    if (comboBoxThatHasChanged == &steal_dropdown_)
+    {
+        synth_.setStealMode((VoiceAllocator::StealMode) (steal_dropdown_.getSelectedId() - 1));
+    }
+    else if (comboBoxThatHasChanged == &grain_dropdown_)
     {
         int selected_id = comboBoxThatHasChanged->getSelectedId();
+        live_grain_enabled_.store(selected_id == kLiveGrainId);
+        if (selected_id == kLiveGrainId)
+            loadLiveGrain();
         if (selected_id < kBuiltinGrainIdOffset)
             return;
 
-        BuiltinGrain& sel_bg =
-            builtin_grains_[selected_id - kBuiltinGrainIdOffset];
-        resetSynth(sel_bg.rname, sel_bg.freq);
+        loadCachedGrain(selected_id - kBuiltinGrainIdOffset);
     }
 }
 
-bool MainComponent::resetSynth(juce::File* grain_file, float grain_freq)
+void MainComponent::loadCachedGrain(int grain_idx)
 {
-    if (grain_freq < 1.0 || grain_freq > 20000.0)
-        return false;
-
-    // Create an AudioFormatReader object for the audio file
-    juce::AudioFormatManager formatManager;
-    formatManager.registerBasicFormats();
-
-    return resetSynth(formatManager.createReaderFor(*grain_file), grain_freq);
-}
-
-bool MainComponent::resetSynth(const char* resource_name, float grain_freq)
-{
-    if (grain_freq < 1.0 || grain_freq > 20000.0)
-        return false;
-
-    // Create an AudioFormatReader object for the audio file
-    juce::AudioFormatManager formatManager;
-    formatManager.registerBasicFormats();
-
-    juce::AudioFormatReader* raw_reader = nullptr;
-    
-    int grain_size;
-    const char* grain_data = BinaryData::getNamedResource(resource_name, grain_size);
-    auto instream = std::make_unique<MemoryInputStream>((const void*) grain_data,
-                                                        static_cast<size_t>(grain_size),
-                                                        false);
-    return resetSynth(formatManager.createReaderFor(std::move(instream)),
-                      grain_freq);
+    // Normally the grain is decoded by now; if not, the loader waits for it
+    grain_loader_.addJob([this, grain_idx]
+    {
+        if (auto grain = grain_cache_.waitForGrain(grain_idx))
+            synth_.loadGrain(grain, parameters_.getEnvelopeParameters());
+    });
 }
 
-bool MainComponent::resetSynth(juce::AudioFormatReader* raw_reader, float grain_freq)
+void MainComponent::loadLiveGrain()
 {
-    if (grain_freq < 1.0 || grain_freq > 20000.0)
-        return false;
-
-    auto reader = std::unique_ptr<AudioFormatReader>(raw_reader);
-
-    if (reader != nullptr)
+    // The voices start silent and pick up grains cut from the input. The
+    // table is copied here, as prepare() may replace it while the job runs
+    grain_loader_.addJob([this, table = live_granulator_.getGrainTable()]
     {
-        auto buffer = std::make_unique<AudioSampleBuffer>(1, reader->lengthInSamples);
-  
-        reader->read(buffer.get(), 0, reader->lengthInSamples, 0, true, true);
-
-        dsp::WindowingFunction<float> window(buffer->getNumSamples(), dsp::WindowingFunction<float>::hann);
-
-        float* channelData = buffer->getWritePointer(0);
-        window.multiplyWithWindowingTable(channelData, buffer->getNumSamples());
-
-        synth_ = std::make_unique<SynthKeyboard>(*buffer, grain_freq);
-
-        addAndMakeVisible(synth_.get());
-
-        synth_->prepareToPlay(samples_per_block_, sample_rate_);
-        resized();
-
-        return true;
-    }
-    fprintf(stderr, "Failed to initialize synth");
-
-    synth_ = nullptr;
-    return false;
+        synth_.loadGrain(table, parameters_.getEnvelopeParameters());
+    });
 }
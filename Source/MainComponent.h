@@ -2,8 +2,14 @@
 
 #include <JuceHeader.h>
 
+#include "AudioCallbackStats.h"
+#include "CallbackStatsView.h"
+#include "GrainCache.h"
+#include "GrainExtractor.h"
+#include "LiveGranulator.h"
+#include "PitchDetector.h"
 #include "SynthKeyboard.h"
-#include "GrainSynth.h"
+#include "SynthParameters.h"
 
 //==============================================================================
 /*
@@ -13,9 +19,9 @@
 class MainComponent  : public juce::AudioAppComponent,
                        public juce::MidiInputCallback,
                        public juce::Slider::Listener,
-                       // public juce::FileDragAndDropTarget,
-                       public juce::ComboBox::Listener,
-                       public juce::ChangeListener
+                       public juce::Button::Listener,
+                       public juce::FileDragAndDropTarget,
+                       public juce::ComboBox::Listener
 {
 public:
     //==============================================================================
@@ -35,57 +41,85 @@ public:
     void handleIncomingMidiMessage (juce::MidiInput* /*source*/,
                                     const juce::MidiMessage& message) override
     {
-        if (synth_)
-            synth_->processMIDIMessage(message);
+        synth_.processMIDIMessage(message);
     }
 
     virtual void sliderValueChanged(juce::Slider* slider) override;
+    virtual void buttonClicked(juce::Button* button) override;
 
-//    virtual bool isInterestedInFileDrag(const StringArray& files) override;
-//    virtual void filesDropped(const StringArray& files, int x, int y) override;
+    virtual bool isInterestedInFileDrag(const StringArray& files) override;
+    virtual void filesDropped(const StringArray& files, int x, int y) override;
     virtual void comboBoxChanged(ComboBox* comboBoxThatHasChanged) override;
-    virtual void changeListenerCallback(ChangeBroadcaster* source) override;
-//    void grainDropCallback(int retval);
+    void grainDropCallback(bool extracted, const juce::String& sample_name);
 private:
     void setupBuiltinGrains();
-    bool resetSynth(juce::AudioFormatReader* raw_reader, float grain_freq);
-    bool resetSynth(juce::File* grain_file, float grain_freq);
-    bool resetSynth(const char* resource_name, float grain_freq);
+    void addBuiltinGrains();
+    void loadCachedGrain(int grain_idx);
+    void loadLiveGrain();
     //==============================================================================
 
     static const int kWindowWidth = 800;
     static const int kKeyboardHeight = 100; // pixels
     static const int kSliderHeight = 300; // pixels
-    static const int kSliderWidth = kWindowWidth / 4; // pixels
+    static const int kSliderWidth = kWindowWidth / 5; // pixels
     static const int kDropdownHeight = 30;
+    static const int kToggleWidth = 160; // pixels
     static const int kCutoffHeight = 40;
-    static const int kDefaultCutoff = 1000.0f;
-    std::unique_ptr<SynthKeyboard> synth_ = nullptr;
+    static const int kInputHeight = 30;
+    static const int kStatsHeight = 40;
+    static const int kCloudHeight = 30;
+    static const int kLoaderTimeoutMs = 5000;
+    SynthParameters parameters_;
+    AudioCallbackStats callback_stats_;
+    SynthEngine synth_;
+    SynthKeyboard keyboard_ { synth_ };
+    GrainCache grain_cache_;
+    juce::ThreadPool grain_loader_ { 1 }; // extracts grains and builds voices
     juce::AudioDeviceSelectorComponent audioSetupComp;
 
     juce::Slider attack_;
     juce::Slider decay_;
     juce::Slider sustain_;
     juce::Slider release_;
+    juce::Slider glide_;
     juce::Slider cutoff_;
 
+    // Grain cloud mode; each slider is a field of GrainCloud::Settings
+    juce::ToggleButton cloud_toggle_ { "Grain cloud" };
+    juce::Slider cloud_density_;
+    juce::Slider cloud_spray_;
+    juce::Slider cloud_position_;
+    juce::Slider cloud_length_;
+
+    juce::ToggleButton period_cache_toggle_ { "Cache held notes" };
+    juce::ToggleButton parallel_toggle_ { "Multi-core render" };
+    juce::ToggleButton mpe_toggle_ { "MPE" };
+    juce::ToggleButton follow_input_toggle_ { "Play from input" };
+    juce::ToggleButton stats_log_toggle_ { "Log CPU stats" };
+
+    CallbackStatsView stats_view_ { callback_stats_, deviceManager };
+    static constexpr const char* kStatsLogFile = "GranularSynth/callback-stats.jsonl";
+
+    PitchDetector pitch_detector_;
+    bool pitch_tracking_ = false; // audio thread only
+    std::atomic<bool> follow_input_ { false };
+    LiveGranulator live_granulator_;
+    std::atomic<bool> live_grain_enabled_ { false };
+
     juce::ComboBox grain_dropdown_;
     static const int kFileGrainId = 1;
-    static const int kBuiltinGrainIdOffset = 2;
-    typedef struct
-    {
-        const char* rname;
-        float freq;
-    } BuiltinGrain;
-    std::vector<BuiltinGrain> builtin_grains_;
+    static const int kLiveGrainId = 2;
+    static const int kBuiltinGrainIdOffset = 3;
+
+    juce::ComboBox steal_dropdown_; // item ids are StealMode values plus one
+    static constexpr const char* kGrainBankFileName = "grains.grainbank";
+    static constexpr const char* kUserGrainFolder = "GranularSynth/Grains";
 
     int samples_per_block_;
     double sample_rate_;
     juce::BigInteger num_chans = 2;
 
-    juce::String grain_filepath_;
-
-    std::vector<juce::IIRFilter> lpfs_;
+    juce::IIRFilter lpf_; // on the mono bus, before the fan-out
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MainComponent)
 };
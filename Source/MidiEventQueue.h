@@ -0,0 +1,69 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/*
+    A wait-free single-producer, single-consumer queue of short MIDI messages
+    and the time they arrived. One thread pushes and the audio thread pops;
+    neither side locks or allocates.
+*/
+class MidiEventQueue
+{
+public:
+    struct Event
+    {
+        juce::uint8 data[3];
+        int size;
+        double time; // seconds, on the Time::getMillisecondCounterHiRes() clock
+
+        juce::MidiMessage toMidiMessage() const noexcept
+        {
+            return juce::MidiMessage(data, size, time);
+        }
+    };
+
+    MidiEventQueue() = default;
+
+    /**
+    Queues a channel message. Returns false, dropping the message, if it is
+    longer than three bytes or the queue is full.
+    */
+    bool push(const juce::MidiMessage& message, double time) noexcept
+    {
+        const int size = message.getRawDataSize();
+        if (size > 3)
+            return false;
+
+        auto scope = fifo_.write(1);
+        if (scope.blockSize1 == 0)
+            return false;
+
+        Event& event = events_[(size_t) scope.startIndex1];
+        std::memcpy(event.data, message.getRawData(), (size_t) size);
+        event.size = size;
+        event.time = time;
+        return true;
+    }
+
+    /**
+    Passes every queued event to callback, oldest first.
+    */
+    template <typename Callback>
+    void popAll(Callback&& callback) noexcept
+    {
+        auto scope = fifo_.read(fifo_.getNumReady());
+        for (int idx = 0; idx < scope.blockSize1; ++idx)
+            callback(events_[(size_t) (scope.startIndex1 + idx)]);
+        for (int idx = 0; idx < scope.blockSize2; ++idx)
+            callback(events_[(size_t) (scope.startIndex2 + idx)]);
+    }
+
+    static const int kCapacity = 1024;
+
+private:
+    juce::AbstractFifo fifo_ { kCapacity };
+    std::array<Event, kCapacity> events_;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MidiEventQueue)
+};
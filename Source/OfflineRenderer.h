@@ -0,0 +1,313 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "GrainCache.h"
+#include "GrainExtractor.h"
+#include "SynthEngine.h"
+#include "SynthParameters.h"
+
+//==============================================================================
+/*
+    Renders MIDI files to WAV without opening a window or an audio device:
+
+        GranularSynth --render --grain=<wav> [--freq=<Hz>] [--out=<folder>]
+                      [--sample-rate=<Hz>] [--threads=<n>] [--voices=<n>]
+                      <file.mid>...
+
+    The grain's base frequency comes from --freq, else from a name like
+    <name>.<base frequency>.wav. Without either, the file is taken as a
+    recording and a grain is extracted from it.
+
+    Each MIDI file gets its own SynthEngine and runs as one job on a thread
+    pool, so several files render at once. Within a file, events are
+    applied at their exact sample, and blocks are rendered back to back
+    with no waiting on a clock.
+*/
+class OfflineRenderer
+{
+public:
+    struct Settings
+    {
+        double sample_rate = 48000.0; // Hz
+        juce::File out_folder; // next to each MIDI file if unset
+        int num_threads = juce::SystemStats::getNumCpus();
+        int num_voices = SynthEngine::kDefaultPolyphony;
+    };
+
+    static bool isRenderCommand(const juce::StringArray& args)
+    {
+        return args.contains("--render");
+    }
+
+    /**
+    Runs the --render command line. Returns the process exit code.
+    */
+    static int run(const juce::StringArray& args)
+    {
+        const juce::ArgumentList arg_list("GranularSynth", args);
+
+        juce::Array<juce::File> midi_files;
+        for (const auto& arg : arg_list.arguments)
+        {
+            if (!arg.isOption())
+                midi_files.add(arg.resolveAsFile());
+        }
+
+        const auto grain_file = juce::File::getCurrentWorkingDirectory()
+                                    .getChildFile(arg_list.getValueForOption("--grain"));
+        if (!grain_file.existsAsFile() || midi_files.isEmpty())
+        {
+            std::cerr << kUsage << std::endl;
+            return 1;
+        }
+
+        Settings settings;
+        if (arg_list.containsOption("--sample-rate"))
+            settings.sample_rate = arg_list.getValueForOption("--sample-rate").getDoubleValue();
+        if (arg_list.containsOption("--threads"))
+            settings.num_threads = arg_list.getValueForOption("--threads").getIntValue();
+        if (arg_list.containsOption("--voices"))
+            settings.num_voices = arg_list.getValueForOption("--voices").getIntValue();
+        if (arg_list.containsOption("--out"))
+            settings.out_folder = juce::File::getCurrentWorkingDirectory()
+                                      .getChildFile(arg_list.getValueForOption("--out"));
+
+        if (settings.sample_rate < 8000.0 || settings.num_threads < 1
+            || settings.num_voices < 1 || settings.num_voices > SynthEngine::kMaxPolyphony)
+        {
+            std::cerr << kUsage << std::endl;
+            return 1;
+        }
+
+        auto grain = loadGrain(grain_file,
+                               arg_list.getValueForOption("--freq").getFloatValue());
+        if (grain == nullptr)
+        {
+            std::cerr << "Could not load grain: <" << grain_file.getFullPathName() << ">"
+                      << std::endl;
+            return 1;
+        }
+
+        return renderAll(midi_files, grain, settings) ? 0 : 1;
+    }
+
+    /**
+    Renders every file in midi_files with grain. Returns false if any of
+    them failed.
+    */
+    static bool renderAll(const juce::Array<juce::File>& midi_files,
+                          GrainTable::Ptr grain,
+                          const Settings& settings)
+    {
+        if (settings.out_folder != juce::File())
+            settings.out_folder.createDirectory();
+
+        juce::OwnedArray<RenderJob> jobs; // outlives the pool
+        juce::ThreadPool pool(juce::jmin(settings.num_threads, midi_files.size()));
+        for (const auto& midi_file : midi_files)
+        {
+            const auto folder = settings.out_folder != juce::File()
+                                    ? settings.out_folder
+                                    : midi_file.getParentDirectory();
+            auto* job = jobs.add(new RenderJob(midi_file,
+                                               folder.getChildFile(midi_file.getFileNameWithoutExtension())
+                                                   .withFileExtension("wav"),
+                                               grain,
+                                               settings.sample_rate,
+                                               settings.num_voices));
+            pool.addJob(job, false);
+        }
+
+        bool all_rendered = true;
+        for (auto* job : jobs)
+        {
+            pool.waitForJobToFinish(job, -1);
+            all_rendered = job->succeeded() && all_rendered;
+        }
+        return all_rendered;
+    }
+
+private:
+    //==========================================================================
+    class RenderJob  : public juce::ThreadPoolJob
+    {
+    public:
+        RenderJob(const juce::File& midi_file,
+                  const juce::File& wav_file,
+                  GrainTable::Ptr grain,
+                  double sample_rate,
+                  int num_voices) :
+            juce::ThreadPoolJob(midi_file.getFileName()),
+            midi_file_(midi_file),
+            wav_file_(wav_file),
+            grain_(grain),
+            sample_rate_(sample_rate),
+            num_voices_(num_voices)
+        { /* Nothing */ }
+
+        JobStatus runJob() override
+        {
+            const double start_time = juce::Time::getMillisecondCounterHiRes();
+            const double rendered_seconds = render();
+            succeeded_ = rendered_seconds >= 0.0;
+
+            if (succeeded_)
+            {
+                const double elapsed = (juce::Time::getMillisecondCounterHiRes() - start_time)
+                    * 0.001;
+                printLine("Rendered " + wav_file_.getFullPathName() + " ("
+                          + juce::String(rendered_seconds, 1) + " s in "
+                          + juce::String(elapsed, 2) + " s)");
+            }
+            return jobHasFinished;
+        }
+
+        bool succeeded() const noexcept
+        {
+            return succeeded_;
+        }
+
+    private:
+        /**
+        Renders the file and returns its length in seconds, or -1 on failure.
+        */
+        double render()
+        {
+            juce::MidiMessageSequence sequence;
+            if (!readMidiFile(sequence))
+            {
+                printLine("Could not read MIDI file: <" + midi_file_.getFullPathName() + ">");
+                return -1.0;
+            }
+
+            wav_file_.deleteFile();
+            std::unique_ptr<juce::OutputStream> stream = wav_file_.createOutputStream();
+            std::unique_ptr<juce::AudioFormatWriter> writer;
+            if (stream != nullptr)
+            {
+                writer.reset(juce::WavAudioFormat().createWriterFor(
+                    stream.get(), sample_rate_, 1, kBitsPerSample, {}, 0));
+            }
+            if (writer == nullptr)
+            {
+                printLine("Could not write: <" + wav_file_.getFullPathName() + ">");
+                return -1.0;
+            }
+            stream.release(); // now owned by writer
+
+            // The same settings the app starts with
+            SynthParameters parameters;
+            parameters.setSampleRate(sample_rate_);
+            parameters.pullSnapshot();
+            const auto& snapshot = parameters.getSnapshot();
+
+            SynthEngine engine(0); // this job is already one of many threads
+            engine.setPolyphony(num_voices_);
+            engine.prepareToPlay(kBlockSize, sample_rate_);
+            engine.setEnvelope(snapshot.envelope, snapshot.envelope_tables);
+            engine.loadGrain(grain_, parameters.getEnvelopeParameters());
+
+            juce::IIRFilter lpf;
+            lpf.setCoefficients(snapshot.lowpass);
+
+            const juce::int64 total_samples = (juce::int64) std::ceil(
+                (sequence.getEndTime() + kTailSeconds) * sample_rate_);
+            juce::AudioSampleBuffer buffer(1, kBlockSize);
+            juce::MidiBuffer block_midi;
+            int next_event = 0;
+
+            for (juce::int64 block_start = 0; block_start < total_samples; block_start += kBlockSize)
+            {
+                if (shouldExit())
+                    return -1.0;
+
+                const int num_samples = (int) juce::jmin<juce::int64>(
+                    kBlockSize, total_samples - block_start);
+
+                block_midi.clear();
+                for (; next_event < sequence.getNumEvents(); ++next_event)
+                {
+                    const auto& message = sequence.getEventPointer(next_event)->message;
+                    const auto sample = (juce::int64) std::llround(
+                        message.getTimeStamp() * sample_rate_);
+                    if (sample >= block_start + num_samples)
+                        break;
+                    if (!message.isMetaEvent())
+                        block_midi.addEvent(message, (int) juce::jmax<juce::int64>(
+                            0, sample - block_start));
+                }
+
+                buffer.setSize(1, num_samples, false, false, true);
+                engine.renderNextBlock(buffer, block_midi);
+                lpf.processSamples(buffer.getWritePointer(0), num_samples);
+                writer->writeFromAudioSampleBuffer(buffer, 0, num_samples);
+            }
+
+            return (double) total_samples / sample_rate_;
+        }
+
+        /**
+        Reads every track of the MIDI file into one sequence, timed in
+        seconds.
+        */
+        bool readMidiFile(juce::MidiMessageSequence& sequence) const
+        {
+            juce::FileInputStream stream(midi_file_);
+            juce::MidiFile midi;
+            if (!stream.openedOk() || !midi.readFrom(stream))
+                return false;
+
+            midi.convertTimestampTicksToSeconds();
+            for (int track_idx = 0; track_idx < midi.getNumTracks(); ++track_idx)
+                sequence.addSequence(*midi.getTrack(track_idx), 0.0);
+            sequence.sort();
+            return true;
+        }
+
+        static void printLine(const juce::String& line)
+        {
+            static std::mutex print_mutex;
+            const std::lock_guard<std::mutex> lock(print_mutex);
+            std::cout << line << std::endl;
+        }
+
+        static const int kBlockSize = 512;
+        static const int kBitsPerSample = 24;
+        static constexpr double kTailSeconds = 2.0; // lets the last releases ring out
+
+        const juce::File midi_file_;
+        const juce::File wav_file_;
+        const GrainTable::Ptr grain_;
+        const double sample_rate_;
+        const int num_voices_;
+        bool succeeded_ = false;
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (RenderJob)
+    };
+
+    /**
+    Decodes and windows the grain. A file with no known base frequency is
+    treated as a recording to extract a grain from.
+    */
+    static GrainTable::Ptr loadGrain(const juce::File& file, float grain_freq)
+    {
+        juce::AudioFormatManager format_manager;
+        format_manager.registerBasicFormats();
+        GrainCache grain_cache(1);
+
+        if (grain_freq <= 0.0f)
+            grain_freq = GrainCache::getFrequencyFromName(file);
+        if (grain_freq > 0.0f)
+            return grain_cache.decodeGrain(format_manager.createReaderFor(file), grain_freq);
+
+        std::unique_ptr<juce::AudioFormatReader> reader(format_manager.createReaderFor(file));
+        GrainExtractor::Grain grain;
+        if (reader == nullptr || !GrainExtractor().extract(*reader, grain))
+            return nullptr;
+        return grain_cache.makeGrain(grain.samples, grain.grain_freq);
+    }
+
+    static constexpr const char* kUsage =
+        "Usage: GranularSynth --render --grain=<wav> [--freq=<Hz>] [--out=<folder>]"
+        " [--sample-rate=<Hz>] [--threads=<n>] [--voices=<n>] <file.mid>...";
+};
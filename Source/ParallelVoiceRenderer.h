@@ -0,0 +1,342 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+#include "VoiceBank.h"
+
+//==============================================================================
+/*
+    Renders a VoiceBank's active voices across a fixed set of worker threads.
+
+    The workers are started once, at high priority, and claim voices from a
+    lock-free job list. The audio thread claims voices too. Every voice renders
+    into its own slot, and the slots are summed in active-list order, so the
+    mix is the same whichever thread rendered each voice.
+
+    The audio thread waits for the workers for at most kMaxWaitFraction of the
+    block. A voice that misses that deadline is left out of the block, and its
+    state is not touched until its worker is done with it.
+*/
+class ParallelVoiceRenderer
+{
+public:
+    /**
+    One worker per spare core; the calling thread renders a share too.
+    */
+    static int getDefaultNumWorkers() noexcept
+    {
+        return juce::jlimit(0, kMaxWorkers, juce::SystemStats::getNumCpus() - 1);
+    }
+
+    ParallelVoiceRenderer(int num_workers = getDefaultNumWorkers())
+    {
+        for (int idx = 0; idx < num_workers; ++idx)
+        {
+            auto* worker = workers_.add(new Worker(*this, idx));
+            worker->startThread(juce::Thread::Priority::highest);
+        }
+    }
+
+    ~ParallelVoiceRenderer()
+    {
+        for (auto* worker : workers_)
+        {
+            worker->signalThreadShouldExit();
+            worker->notify();
+        }
+        for (auto* worker : workers_)
+        {
+            worker->stopThread(1000);
+        }
+    }
+
+    /**
+    Allocates a render slot per voice, first waiting for any worker still
+    rendering a late voice. Not real-time safe.
+    */
+    void prepare(int num_voices, int samplesPerBlockExpected, double sampleRate)
+    {
+        waitUntilIdle();
+
+        num_voices_ = num_voices;
+        slot_size_ = juce::jmax(samplesPerBlockExpected, 1);
+        sample_rate_ = sampleRate;
+
+        slots_.calloc((size_t) (num_voices * slot_size_));
+        job_voices_.calloc((size_t) num_voices);
+        skip_voices_.calloc((size_t) num_voices);
+        job_done_.reset(new std::atomic<bool>[(size_t) num_voices]);
+        voice_busy_.reset(new std::atomic<bool>[(size_t) num_voices]);
+        for (int idx = 0; idx < num_voices; ++idx)
+        {
+            job_done_[idx].store(false);
+            voice_busy_[idx].store(false);
+        }
+    }
+
+    int getNumWorkers() const noexcept
+    {
+        return workers_.size();
+    }
+
+    /**
+    False while a worker is still rendering a voice from an earlier block.
+    Until then the bank must only be rendered through this object.
+    */
+    bool isIdle() const noexcept
+    {
+        return active_workers_.load() == 0;
+    }
+
+    /**
+    Blocks until isIdle(). Not real-time safe; for offline rendering,
+    where waiting beats leaving events for a later block, and for anything
+    that reallocates what the workers touch.
+    */
+    void waitUntilIdle() const noexcept
+    {
+        while (!isIdle())
+            std::this_thread::yield();
+    }
+
+    /**
+    True while a worker from an earlier block is still rendering voice.
+    Nothing may change the voice's state until this is false.
+    */
+    bool isVoiceBusy(int voice) const noexcept
+    {
+        return !isIdle() && voice_busy_[voice].load(std::memory_order_acquire);
+    }
+
+    /**
+    Counts voices that missed the deadline and were left out of a block.
+    */
+    int getNumLateVoices() const noexcept
+    {
+        return late_voices_.load();
+    }
+
+    /**
+    Overwrites mono_out with the sum of the bank's active voices.
+    */
+    void renderNextBlock(VoiceBank& bank, float* mono_out, int num_samples)
+    {
+        jassert(bank.getNumVoices() <= num_voices_);
+
+        juce::FloatVectorOperations::clear(mono_out, num_samples);
+
+        for (int start = 0; start < num_samples; start += slot_size_)
+        {
+            const int len = juce::jmin(slot_size_, num_samples - start);
+
+            // Workers still busy with an earlier block hold on to the job
+            // list, so this chunk is rendered on the audio thread
+            if (active_workers_.load() == 0)
+                renderChunkParallel(bank, mono_out + start, len);
+            else
+                renderChunkSerial(bank, mono_out + start, len);
+        }
+
+        bank.finishBlock(skip_voices_.get());
+
+        const int* voices = bank.getActiveVoices();
+        for (int active = 0; active < bank.getNumActiveVoices(); ++active)
+        {
+            skip_voices_[voices[active]] = 0;
+        }
+    }
+
+private:
+    //==========================================================================
+    class Worker : public juce::Thread
+    {
+    public:
+        Worker(ParallelVoiceRenderer& owner, int idx) :
+            juce::Thread("Voice renderer " + juce::String(idx)),
+            owner_(owner)
+        { /* Nothing */ }
+
+        void run() override
+        {
+            juce::ScopedNoDenormals no_denormals;
+            while (!threadShouldExit())
+            {
+                wait(-1);
+                owner_.active_workers_.fetch_add(1);
+                owner_.runJobs();
+                owner_.active_workers_.fetch_sub(1);
+            }
+        }
+
+    private:
+        ParallelVoiceRenderer& owner_;
+    };
+
+    //==========================================================================
+    // A ticket packs the job count into the high 32 bits and the next
+    // unclaimed job into the low 32 bits, so claiming is a single CAS
+    static juce::int64 makeTicket(int num_jobs, int next_job) noexcept
+    {
+        return ((juce::int64) num_jobs << 32) | (juce::int64) next_job;
+    }
+
+    bool claimJob(int& job) noexcept
+    {
+        juce::int64 ticket = next_job_.load(std::memory_order_acquire);
+        for (;;)
+        {
+            int num_jobs = (int) (ticket >> 32);
+            int next_job = (int) (ticket & 0xffffffff);
+            if (next_job >= num_jobs)
+                return false;
+
+            if (next_job_.compare_exchange_weak(ticket,
+                                                ticket + 1,
+                                                std::memory_order_acq_rel,
+                                                std::memory_order_acquire))
+            {
+                job = next_job;
+                return true;
+            }
+        }
+    }
+
+    void runJobs() noexcept
+    {
+        // Envelope time is summed here and published once, after the last
+        // voice, so threads do not contend on the bank's counter per voice
+        juce::int64 envelope_ticks = 0;
+        VoiceBank* bank = nullptr;
+
+        int job;
+        while (claimJob(job))
+        {
+            // The bank stays alive until every worker is idle
+            bank = bank_;
+            int voice = job_voices_[job];
+            bank->renderVoice(voice, getSlot(voice), num_samples_,
+                              bank->isEnvelopeTimingEnabled() ? &envelope_ticks : nullptr);
+            job_done_[job].store(true, std::memory_order_release);
+            voice_busy_[voice].store(false, std::memory_order_release);
+            jobs_done_.fetch_add(1, std::memory_order_release);
+        }
+
+        if (bank != nullptr)
+            bank->addEnvelopeTicks(envelope_ticks);
+    }
+
+    float* getSlot(int voice) noexcept
+    {
+        return slots_.get() + voice * slot_size_;
+    }
+
+    void renderChunkParallel(VoiceBank& bank, float* dst, int num_samples)
+    {
+        const int* voices = bank.getActiveVoices();
+        int num_jobs = 0;
+        for (int active = 0; active < bank.getNumActiveVoices(); ++active)
+        {
+            int voice = voices[active];
+            if (skip_voices_[voice])
+                continue;
+
+            job_voices_[num_jobs] = voice;
+            job_done_[num_jobs].store(false, std::memory_order_relaxed);
+            voice_busy_[voice].store(true, std::memory_order_relaxed);
+            ++num_jobs;
+        }
+
+        bank_ = &bank;
+        num_samples_ = num_samples;
+        jobs_done_.store(0, std::memory_order_relaxed);
+        next_job_.store(makeTicket(num_jobs, 0), std::memory_order_release);
+
+        for (int idx = 0; idx < juce::jmin(num_jobs - 1, workers_.size()); ++idx)
+        {
+            workers_[idx]->notify();
+        }
+
+        runJobs();
+
+        const double deadline = juce::Time::getMillisecondCounterHiRes()
+            + 1000.0 * kMaxWaitFraction * num_samples / sample_rate_;
+        while (jobs_done_.load(std::memory_order_acquire) < num_jobs &&
+               juce::Time::getMillisecondCounterHiRes() < deadline)
+        {
+            std::this_thread::yield();
+        }
+
+        // Close the job list; anything still claimed is late, and anything
+        // never claimed is not being rendered at all
+        const int num_claimed = (int) (next_job_.exchange(makeTicket(0, 0),
+                                                          std::memory_order_acq_rel)
+                                       & 0xffffffff);
+
+        for (int job = 0; job < num_jobs; ++job)
+        {
+            int voice = job_voices_[job];
+            if (job_done_[job].load(std::memory_order_acquire))
+            {
+                juce::FloatVectorOperations::add(dst, getSlot(voice),
+                                                 num_samples);
+            }
+            else
+            {
+                if (job >= num_claimed)
+                    voice_busy_[voice].store(false, std::memory_order_relaxed);
+                skip_voices_[voice] = 1;
+                late_voices_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void renderChunkSerial(VoiceBank& bank, float* dst, int num_samples)
+    {
+        juce::int64 envelope_ticks = 0;
+        auto* timing = bank.isEnvelopeTimingEnabled() ? &envelope_ticks : nullptr;
+
+        const int* voices = bank.getActiveVoices();
+        for (int active = 0; active < bank.getNumActiveVoices(); ++active)
+        {
+            int voice = voices[active];
+            if (voice_busy_[voice].load(std::memory_order_acquire))
+            {
+                skip_voices_[voice] = 1;
+                continue;
+            }
+            if (skip_voices_[voice])
+                continue;
+
+            bank.renderVoice(voice, getSlot(voice), num_samples, timing);
+            juce::FloatVectorOperations::add(dst, getSlot(voice), num_samples);
+        }
+
+        bank.addEnvelopeTicks(envelope_ticks);
+    }
+
+    static const int kMaxWorkers = 8;
+    static constexpr double kMaxWaitFraction = 0.5;
+
+    juce::OwnedArray<Worker> workers_;
+    std::atomic<int> active_workers_ { 0 };
+
+    // Begin job list, written by the audio thread before each ticket
+    VoiceBank* bank_ = nullptr;
+    int num_samples_ = 0;
+    juce::HeapBlock<int> job_voices_;
+    std::unique_ptr<std::atomic<bool>[]> job_done_;
+    // End job list
+
+    std::atomic<juce::int64> next_job_ { 0 };
+    std::atomic<int> jobs_done_ { 0 };
+    std::unique_ptr<std::atomic<bool>[]> voice_busy_;
+    juce::HeapBlock<juce::uint8> skip_voices_; // audio thread only
+    std::atomic<int> late_voices_ { 0 };
+
+    int num_voices_ = 0;
+    int slot_size_ = 0;
+    double sample_rate_ = 48000.0;
+    juce::HeapBlock<float> slots_; // slot_size_ samples per voice
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ParallelVoiceRenderer)
+};
@@ -14,12 +14,214 @@
 //==============================================================================
 PitchDetector::PitchDetector()
 {
-    // In your constructor, you should add any child components, and
-    // initialise any special settings that your component needs.
-
+    startTimerHz(kRepaintHz);
 }
 
 PitchDetector::~PitchDetector()
 {
+    stopTimer();
+}
+
+void PitchDetector::prepare(double sampleRate)
+{
+    sample_rate_ = sampleRate;
+
+    // A frame holds two of the longest periods: one to compare, one to shift by
+    const int order = juce::jmax(
+        6, (int) std::ceil(std::log2(2.0 * sampleRate / kMinFrequency)));
+    fft_ = std::make_unique<juce::dsp::FFT>(order);
+    frame_size_ = fft_->getSize();
+    hop_size_ = frame_size_ / kHopsPerFrame;
+
+    history_.calloc((size_t) frame_size_);
+    frame_.calloc((size_t) frame_size_);
+    frame_spectrum_.calloc((size_t) frame_size_ * 2);
+    window_spectrum_.calloc((size_t) frame_size_ * 2);
+    difference_.calloc((size_t) frame_size_ / 2);
+
+    reset();
+}
+
+void PitchDetector::reset() noexcept
+{
+    if (fft_ == nullptr)
+        return;
+
+    juce::FloatVectorOperations::clear(history_, frame_size_);
+    write_pos_ = 0;
+    samples_to_hop_ = hop_size_;
+    unpitched_hops_ = kReleaseHops;
+    frequency_.store(0.0f);
+    confidence_.store(0.0f);
+}
+
+void PitchDetector::processInput(const float* input, int num_samples) noexcept
+{
+    if (fft_ == nullptr)
+        return;
+
+    while (num_samples > 0)
+    {
+        const int len = juce::jmin(num_samples,
+                                   samples_to_hop_,
+                                   frame_size_ - write_pos_);
+        juce::FloatVectorOperations::copy(history_ + write_pos_, input, len);
+
+        write_pos_ = (write_pos_ + len) % frame_size_;
+        samples_to_hop_ -= len;
+        input += len;
+        num_samples -= len;
+
+        if (samples_to_hop_ == 0)
+        {
+            analyseFrame();
+            samples_to_hop_ = hop_size_;
+        }
+    }
+}
+
+float PitchDetector::getMidiPitch() const noexcept
+{
+    const float freq = getFrequency();
+    return freq > 0.0f ? 69.0f + 12.0f * std::log2(freq / 440.0f) : -1.0f;
+}
+
+void PitchDetector::analyseFrame() noexcept
+{
+    const float period = findPeriod();
+    if (period > 0.0f)
+    {
+        unpitched_hops_ = 0;
+        frequency_.store((float) (sample_rate_ / period), std::memory_order_relaxed);
+    }
+    else if (++unpitched_hops_ >= kReleaseHops)
+    {
+        // Short dropouts keep the last pitch, so a held note is not retriggered
+        unpitched_hops_ = kReleaseHops;
+        frequency_.store(0.0f, std::memory_order_relaxed);
+    }
 }
 
+float PitchDetector::findPeriod() noexcept
+{
+    const int window_size = frame_size_ / 2;
+
+    // Unroll the history, oldest sample first
+    float* frame = frame_.get();
+    const int older = frame_size_ - write_pos_;
+    juce::FloatVectorOperations::copy(frame, history_ + write_pos_, older);
+    juce::FloatVectorOperations::copy(frame + older, history_.get(), write_pos_);
+
+    double energy = 0.0;
+    for (int idx = 0; idx < window_size; ++idx)
+        energy += frame[idx] * frame[idx];
+
+    if (energy < kMinLevel * window_size)
+    {
+        confidence_.store(0.0f, std::memory_order_relaxed);
+        return 0.0f;
+    }
+
+    // Cross-correlation of the first half of the frame with all of it:
+    // correlation[lag] is the sum of frame[j] * frame[j + lag]. The lags
+    // used never wrap around, so the frame needs no zero padding.
+    float* window = window_spectrum_.get();
+    juce::FloatVectorOperations::copy(window, frame, window_size);
+    juce::FloatVectorOperations::clear(window + window_size, 2 * frame_size_ - window_size);
+
+    float* spectrum = frame_spectrum_.get();
+    juce::FloatVectorOperations::copy(spectrum, frame, frame_size_);
+    juce::FloatVectorOperations::clear(spectrum + frame_size_, frame_size_);
+
+    fft_->performRealOnlyForwardTransform(window, true);
+    fft_->performRealOnlyForwardTransform(spectrum, true);
+    for (int bin = 0; bin <= frame_size_ / 2; ++bin)
+    {
+        const float wr = window[2 * bin], wi = window[2 * bin + 1];
+        const float sr = spectrum[2 * bin], si = spectrum[2 * bin + 1];
+        window[2 * bin] = wr * sr + wi * si;
+        window[2 * bin + 1] = wr * si - wi * sr;
+    }
+    fft_->performRealOnlyInverseTransform(window);
+    const float* correlation = window;
+
+    // FFT back ends scale the inverse differently; at lag 0 it must equal
+    // the window's energy
+    const double scale = correlation[0] > 0.0f ? energy / correlation[0] : 0.0;
+
+    // YIN's cumulative mean normalised difference. The energy of the
+    // shifted window is updated one sample at a time as the lag grows.
+    double shifted_energy = energy;
+    double running_sum = 0.0;
+    difference_[0] = 1.0f;
+    for (int lag = 1; lag < window_size; ++lag)
+    {
+        shifted_energy += frame[lag + window_size - 1] * frame[lag + window_size - 1]
+            - frame[lag - 1] * frame[lag - 1];
+
+        const double diff = juce::jmax(
+            0.0, energy + shifted_energy - 2.0 * scale * correlation[lag]);
+        running_sum += diff;
+        difference_[lag] = running_sum > 0.0 ? (float) (diff * lag / running_sum) : 1.0f;
+    }
+
+    // The first dip below the threshold, followed down to its minimum
+    const int min_lag = juce::jmax(2, (int) (sample_rate_ / kMaxFrequency));
+    int period = 0;
+    for (int lag = min_lag; lag < window_size - 1; ++lag)
+    {
+        if (difference_[lag] < kThreshold)
+        {
+            while (lag + 2 < window_size && difference_[lag + 1] < difference_[lag])
+                ++lag;
+            period = lag;
+            break;
+        }
+    }
+
+    if (period == 0)
+    {
+        confidence_.store(0.0f, std::memory_order_relaxed);
+        return 0.0f;
+    }
+    confidence_.store(1.0f - difference_[period], std::memory_order_relaxed);
+
+    // A parabola through the dip and its neighbours places it between samples
+    const float before = difference_[period - 1];
+    const float dip = difference_[period];
+    const float after = difference_[period + 1];
+    const float curvature = before - 2.0f * dip + after;
+    const float offset = curvature > 0.0f
+        ? juce::jlimit(-0.5f, 0.5f, 0.5f * (before - after) / curvature)
+        : 0.0f;
+
+    return period + offset;
+}
+
+void PitchDetector::timerCallback()
+{
+    const float freq = getFrequency();
+    if (freq != shown_frequency_)
+    {
+        shown_frequency_ = freq;
+        repaint();
+    }
+}
+
+void PitchDetector::paint(juce::Graphics& g)
+{
+    juce::String text = "Input pitch: -";
+    if (shown_frequency_ > 0.0f)
+    {
+        const float pitch = 69.0f + 12.0f * std::log2(shown_frequency_ / 440.0f);
+        const int note = juce::roundToInt(pitch);
+        const int cents = juce::roundToInt((pitch - note) * 100.0f);
+        text = "Input pitch: "
+            + juce::MidiMessage::getMidiNoteName(note, true, true, 4)
+            + (cents >= 0 ? " +" : " ") + juce::String(cents) + " cents ("
+            + juce::String(shown_frequency_, 1) + " Hz)";
+    }
+
+    g.setColour(getLookAndFeel().findColour(juce::Label::textColourId));
+    g.drawText(text, getLocalBounds().reduced(4, 0), juce::Justification::centredLeft);
+}
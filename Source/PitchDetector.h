@@ -14,12 +14,97 @@
 
 //==============================================================================
 /*
+    Tracks the pitch of the audio input with YIN, and shows it.
+
+    The audio thread feeds the input through processInput(). Every hop, the
+    latest frame is analysed. YIN's difference function comes from a single
+    FFT cross-correlation, so one analysis costs two forward FFTs and one
+    inverse. Nothing allocates after prepare(). The result is published
+    through atomics that any thread can read.
 */
-class PitchDetector  : public juce::Component
+class PitchDetector  : public juce::Component,
+                       private juce::Timer
 {
 public:
     PitchDetector();
     ~PitchDetector() override;
+
+    /**
+    Sizes the analysis for a sample rate. Allocates; call while audio is
+    stopped.
+    */
+    void prepare(double sampleRate);
+
+    /**
+    Feeds input samples. Audio thread only; never allocates or locks.
+    */
+    void processInput(const float* input, int num_samples) noexcept;
+
+    /**
+    Forgets the input heard so far, as if prepare() had just run. Audio
+    thread only; never allocates or locks.
+    */
+    void reset() noexcept;
+
+    /**
+    The tracked pitch in Hz, or 0 while the input is quiet or unpitched.
+    */
+    float getFrequency() const noexcept
+    {
+        return frequency_.load(std::memory_order_relaxed);
+    }
+
+    /**
+    The tracked pitch as a fractional MIDI note number, or -1 while the
+    input is quiet or unpitched.
+    */
+    float getMidiPitch() const noexcept;
+
+    /**
+    How periodic the last analysed frame was, from 0 to 1.
+    */
+    float getConfidence() const noexcept
+    {
+        return confidence_.load(std::memory_order_relaxed);
+    }
+
+    void paint(juce::Graphics& g) override;
+
 private:
+    void timerCallback() override;
+
+    void analyseFrame() noexcept;
+
+    // The period of the frame in samples, or 0 if it has none
+    float findPeriod() noexcept;
+
+    static constexpr float kMinFrequency = 50.0f; // Hz, sets the frame size
+    static constexpr float kMaxFrequency = 1500.0f; // Hz
+    static constexpr float kThreshold = 0.15f; // YIN's absolute threshold
+    static constexpr float kMinLevel = 1e-5f; // mean square, about -50 dBFS
+    static const int kHopsPerFrame = 8;
+    static const int kReleaseHops = 3; // unpitched hops before a pitch is dropped
+    static const int kRepaintHz = 30;
+
+    std::unique_ptr<juce::dsp::FFT> fft_;
+    int frame_size_ = 0; // twice the longest period, a power of two
+    int hop_size_ = 0;
+    double sample_rate_ = 0.0;
+
+    juce::HeapBlock<float> history_; // the last frame_size_ samples, circular
+    int write_pos_ = 0;
+    int samples_to_hop_ = 0;
+
+    juce::HeapBlock<float> frame_; // history_ in order
+    juce::HeapBlock<float> frame_spectrum_; // 2 * frame_size_
+    juce::HeapBlock<float> window_spectrum_; // 2 * frame_size_
+    juce::HeapBlock<float> difference_; // frame_size_ / 2
+
+    int unpitched_hops_ = 0;
+    std::atomic<float> frequency_ { 0.0f };
+    std::atomic<float> confidence_ { 0.0f };
+
+    float shown_frequency_ = -1.0f; // message thread only
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PitchDetector)
 };
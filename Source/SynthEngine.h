@@ -0,0 +1,984 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "AudioCallbackStats.h"
+#include "VoiceBank.h"
+#include "ParallelVoiceRenderer.h"
+#include "MidiEventQueue.h"
+#include "VoiceAllocator.h"
+
+//==============================================================================
+/*
+    The synth itself: voices, note handling and grain hot-swapping, with no
+    UI. Lives for the whole session; loading a grain swaps in a new
+    VoiceBank without stopping audio.
+
+    The audio thread owns the current VoiceBank. A new bank is built on a
+    background thread and handed over through pending_bank_. The old one
+    fades out, then goes back to the message thread through retired_banks_
+    to be deleted by releaseRetiredBanks().
+
+    Live playback takes timestamped MIDI through getNextAudioBlock(). An
+    offline render passes sample-positioned events to renderNextBlock().
+*/
+class SynthEngine  : public juce::AudioSource
+{
+public:
+    static const int kLowestNote = 21; // A0
+    static const int kHighestNote = 108; // C8
+    static const int kDefaultPolyphony = 32;
+    static const int kMaxPolyphony = 256;
+
+    /**
+    An offline render passes 0 workers and renders every voice on the
+    calling thread.
+    */
+    explicit SynthEngine(int num_render_workers = ParallelVoiceRenderer::getDefaultNumWorkers()) :
+        parallel_renderer_(num_render_workers)
+    {
+        setNumVoices(kDefaultPolyphony);
+        parallel_renderer_.prepare(num_voices_, kDefaultBlockSize, kDefaultSampleRate);
+        fade_buffer_size_ = kDefaultBlockSize;
+        fade_buffer_.calloc((size_t) fade_buffer_size_);
+
+        mix_gain_.reset(kDefaultSampleRate, kMixGainRampTime);
+        mix_gain_.setCurrentAndTargetValue(calcMixGain(1));
+    }
+
+    virtual ~SynthEngine()
+    {
+        deleteRetiredBanks(false);
+        delete pending_bank_.exchange(nullptr);
+        delete fading_bank_;
+        delete voices_;
+    }
+
+    //==========================================================================
+    // Grain loading
+
+    /**
+    Builds the voices for a new grain and queues them for the audio thread,
+    which switches over at the start of its next block. Allocates; call from
+    a background thread.
+    */
+    void loadGrain(GrainTable::Ptr grain, const CustomADSR::Parameters& envelope)
+    {
+        // Loads are published in the order they were asked for
+        const juce::ScopedLock lock(load_lock_);
+        latest_grain_ = grain;
+        latest_envelope_ = envelope;
+
+        // The generation is read before the settings it covers. A
+        // prepareToPlay() that lands meanwhile leaves the bank with an old
+        // generation, and the audio thread sends it back to be loaded again.
+        const int generation = generation_.load(std::memory_order_acquire);
+        auto bank = std::make_unique<VoiceBank>(grain, prepared_num_voices_.load(), envelope,
+                                                period_cache_enabled_.load());
+        bank->setOrigin({ latest_load_.fetch_add(1) + 1, generation });
+
+        // Notes above kHighestNote still play, but may run out of grains
+        bank->setHighestFrequency(midiToFreq(kHighestNote));
+        bank->prepareToPlay(prepared_block_size_.load(),
+                            prepared_sample_rate_.load());
+
+        // A bank the audio thread never picked up can go straight away
+        delete pending_bank_.exchange(bank.release());
+    }
+
+    /**
+    Length of the crossfade from the old grain to the new one. Zero switches
+    at once.
+    */
+    void setCrossfadeTime(float seconds) noexcept
+    {
+        crossfade_time_.store(seconds);
+    }
+
+    /**
+    Builds the voices for the most recent grain again, with the current
+    settings. Allocates; call from a background thread.
+    */
+    void reloadLatestGrain()
+    {
+        const juce::ScopedLock lock(load_lock_);
+        if (latest_grain_ != nullptr)
+            loadGrain(latest_grain_, latest_envelope_);
+    }
+
+    /**
+    Deletes the banks the audio thread has finished with. A bank it turned
+    down because it was built for an earlier prepareToPlay() has its grain
+    loaded again, unless a newer grain has been asked for since. Call
+    regularly from the message thread.
+    */
+    void releaseRetiredBanks()
+    {
+        deleteRetiredBanks(true);
+    }
+
+    /**
+    Sets how the latest grain is loaded again when the voices have to be
+    rebuilt, typically by queueing reloadLatestGrain() on a background
+    thread. Without one, it is reloaded on the message thread. Call before
+    audio starts.
+    */
+    void setGrainReloader(std::function<void()> reload)
+    {
+        reload_grain_ = std::move(reload);
+    }
+
+    //==========================================================================
+    // Polyphony
+
+    /**
+    A polyphony to suit this machine: every core can render a share of
+    the voices.
+    */
+    static int getDefaultPolyphony()
+    {
+        return juce::jlimit(kDefaultPolyphony,
+                            kMaxPolyphony,
+                            kVoicesPerCpu * juce::SystemStats::getNumCpus());
+    }
+
+    /**
+    Sets how many notes can sound at once, from the next prepareToPlay().
+    Exactly that many voices are allocated, so a small setting costs no
+    memory for voices that are never used. Changing it silences every
+    note.
+    */
+    void setPolyphony(int num_voices) noexcept
+    {
+        polyphony_.store(juce::jlimit(1, kMaxPolyphony, num_voices));
+    }
+
+    //==========================================================================
+    // Live MIDI
+
+    /**
+    Queues a message for the audio thread. Call from the MIDI input thread
+    only; the message's timestamp places it within a later block.
+    */
+    void processMIDIMessage(const juce::MidiMessage& message)
+    {
+        midi_queue_.push(message, message.getTimeStamp());
+    }
+
+    /**
+    Queues a message from the on-screen keyboard. Message thread only.
+    */
+    void processUIMessage(const juce::MidiMessage& message)
+    {
+        ui_queue_.push(message, juce::Time::getMillisecondCounterHiRes() * 0.001);
+    }
+
+    //==========================================================================
+    // Pitch following
+
+    /**
+    Plays one extra note that follows a tracked pitch, such as the audio
+    input's, as a fractional MIDI note number. A negative pitch releases
+    it. Audio thread only, before getNextAudioBlock().
+    */
+    void setFollowedPitch(float pitch) noexcept
+    {
+        followed_pitch_ = pitch;
+    }
+ 
+
+    //==========================================================================
+    // AudioSource
+ 
+    virtual void prepareToPlay(int samplesPerBlockExpected, double sampleRate) override
+    {
+        // A worker that missed the last deadline may still be inside a
+        // bank that is about to be resized, deleted or re-prepared
+        parallel_renderer_.waitUntilIdle();
+
+        prepared_block_size_.store(samplesPerBlockExpected);
+        prepared_sample_rate_.store(sampleRate);
+        setNumVoices(polyphony_.load());
+        const int generation = generation_.fetch_add(1, std::memory_order_acq_rel) + 1;
+
+        for (auto* bank : { voices_, fading_bank_ })
+        {
+            if (bank != nullptr)
+                bank->prepareToPlay(samplesPerBlockExpected, sampleRate);
+        }
+        if (auto* pending = pending_bank_.exchange(nullptr))
+        {
+            pending = resizeBank(pending);
+            pending->prepareToPlay(samplesPerBlockExpected, sampleRate);
+            pending->setOrigin({ pending->getOrigin().load, generation });
+            VoiceBank* expected = nullptr;
+            if (!pending_bank_.compare_exchange_strong(expected, pending))
+                delete pending; // a newer bank arrived meanwhile
+        }
+
+        parallel_renderer_.prepare(num_voices_, samplesPerBlockExpected, sampleRate);
+        fade_buffer_size_ = juce::jmax(samplesPerBlockExpected, kDefaultBlockSize);
+        fade_buffer_.calloc((size_t) fade_buffer_size_);
+        sample_rate_ = sampleRate;
+        last_block_time_ = juce::Time::getMillisecondCounterHiRes() * 0.001;
+        mix_gain_.reset(sampleRate, kMixGainRampTime);
+    }
+ 
+    virtual void releaseResources() override
+    { /* Nothing */ }
+
+    virtual void getNextAudioBlock(const juce::AudioSourceChannelInfo& bufferToFill) override
+    {
+        renderMonoBlock(bufferToFill.buffer->getWritePointer(0, bufferToFill.startSample),
+                        bufferToFill.numSamples);
+
+        const AudioCallbackStats::ScopedStage stage(callback_stats_, AudioCallbackStats::kMix);
+        copyToAllChannels(*bufferToFill.buffer, bufferToFill.startSample, bufferToFill.numSamples);
+    }
+
+    /**
+    Renders the next block of live MIDI into one channel. The synth is mono,
+    so a caller that post-processes it can do so once and fan out to the
+    device's channels at the end, instead of calling getNextAudioBlock().
+    */
+    void renderMonoBlock(float* mono_out, int num_samples) noexcept
+    {
+        collectBlockEvents(num_samples);
+
+        if (!beginBlock())
+        {
+            juce::FloatVectorOperations::clear(mono_out, num_samples);
+            return;
+        }
+
+        {
+            const AudioCallbackStats::ScopedStage stage(callback_stats_, AudioCallbackStats::kVoices);
+
+            // Split the block at each event so notes start on the right sample
+            int pos = 0;
+            for (int idx = 0; idx < num_block_events_; ++idx)
+            {
+                const auto& block_event = block_events_[idx];
+                if (block_event.offset > pos)
+                {
+                    renderVoices(mono_out + pos, block_event.offset - pos);
+                    pos = block_event.offset;
+                }
+                if (!applyMIDIMessage(block_event.event.toMidiMessage()))
+                {
+                    deferEvents(idx);
+                    break;
+                }
+            }
+            if (pos < num_samples)
+                renderVoices(mono_out + pos, num_samples - pos);
+        }
+
+        if (callback_stats_ != nullptr)
+        {
+            juce::int64 envelope_ticks = voices_->takeEnvelopeTicks();
+            if (fading_bank_ != nullptr)
+                envelope_ticks += fading_bank_->takeEnvelopeTicks();
+            callback_stats_->addStageTicks(AudioCallbackStats::kEnvelope, envelope_ticks);
+        }
+    }
+
+    //==========================================================================
+    // Offline rendering
+
+    /**
+    Renders the whole of buffer, applying each event in midi at its sample
+    position. For offline use in place of getNextAudioBlock(); the live
+    MIDI queues are left alone.
+    */
+    void renderNextBlock(juce::AudioBuffer<float>& buffer, const juce::MidiBuffer& midi) noexcept
+    {
+        auto* buf0 = buffer.getWritePointer(0);
+        const int num_samples = buffer.getNumSamples();
+
+        if (!beginBlock())
+        {
+            buffer.clear();
+            return;
+        }
+
+        int pos = 0;
+        for (const auto metadata : midi)
+        {
+            const int offset = juce::jlimit(0, num_samples, metadata.samplePosition);
+            if (offset > pos)
+            {
+                renderVoices(buf0 + pos, offset - pos);
+                pos = offset;
+            }
+            if (!applyMIDIMessage(metadata.getMessage()))
+            {
+                // Offline there is time to let a late voice finish
+                parallel_renderer_.waitUntilIdle();
+                applyMIDIMessage(metadata.getMessage());
+            }
+        }
+        if (pos < num_samples)
+            renderVoices(buf0 + pos, num_samples - pos);
+
+        copyToAllChannels(buffer, 0, num_samples);
+    }
+
+    /**
+    The synth is mono; fills every other channel of buffer with a copy of
+    the first.
+    */
+    static void copyToAllChannels(juce::AudioBuffer<float>& buffer,
+                                  int start_sample,
+                                  int num_samples) noexcept
+    {
+        for (int chan_idx = 1; chan_idx < buffer.getNumChannels(); ++chan_idx)
+        {
+            juce::FloatVectorOperations::copy(
+                buffer.getWritePointer(chan_idx, start_sample),
+                buffer.getReadPointer(0, start_sample),
+                num_samples);
+        }
+    }
+
+    static constexpr inline float midiToFreq(juce::uint8 midi_note)
+    {
+        return 440.0 * std::pow(2.0, (midi_note - 69) / 12.0);
+    }
+
+    //==========================================================================
+    // Settings
+
+    /**
+    True when no voice is being rendered, so setEnvelope() may be called.
+    Audio thread only.
+    */
+    bool isReadyForParameters() const noexcept
+    {
+        return parallel_renderer_.isIdle();
+    }
+
+    /**
+    Points new grains at freshly cut live samples, if the current voices
+    were built on live_table. Audio thread only, between blocks, once
+    isReadyForParameters() is true.
+    */
+    void setLiveGrainData(const GrainTable* live_table,
+                          const float* data,
+                          const float* source) noexcept
+    {
+        if (voices_ != nullptr && voices_->getGrain() == live_table)
+            voices_->setGrainData(data, source);
+    }
+
+    /**
+    Applies new envelope settings to every voice without retriggering them.
+    Audio thread only, between blocks, once isReadyForParameters() is true.
+    The tables only have to outlive the next call: the fading bank is
+    retuned too, so no bank keeps reading older ones.
+    */
+    void setEnvelope(const CustomADSR::Parameters& envelope,
+                     const CustomADSR::Tables& tables) noexcept
+    {
+        envelope_ = envelope;
+        envelope_tables_ = tables;
+        for (auto* bank : { voices_, fading_bank_ })
+        {
+            if (bank != nullptr)
+                bank->setEnvelope(envelope, tables);
+        }
+    }
+
+    void setGlideTime(float seconds) noexcept
+    {
+        glide_time_.store(seconds);
+    }
+
+    /**
+    Only banks built with the cache have room for it, so a change rebuilds
+    the voices for the latest grain. Call from the message thread.
+    */
+    void setPeriodCacheEnabled(bool enabled)
+    {
+        if (period_cache_enabled_.exchange(enabled) != enabled)
+            requestReload();
+    }
+
+    /**
+    Switches every voice between pitch-synchronous grains and asynchronous
+    grain clouds.
+    */
+    void setCloudEnabled(bool enabled) noexcept
+    {
+        cloud_enabled_.store(enabled);
+    }
+
+    void setCloudSettings(const GrainCloud::Settings& settings) noexcept
+    {
+        cloud_density_.store(settings.density);
+        cloud_spray_.store(settings.spray);
+        cloud_position_.store(settings.position);
+        cloud_length_.store(settings.length);
+    }
+
+    /**
+    In MPE mode each note's channel carries its own pitch bend over
+    kMPENoteBendRange, and channel 1 bends every note.
+    */
+    void setMPEEnabled(bool enabled) noexcept
+    {
+        mpe_enabled_.store(enabled);
+    }
+
+    /**
+    Which voice a note takes when all of them are sounding.
+    */
+    void setStealMode(VoiceAllocator::StealMode mode) noexcept
+    {
+        steal_mode_.store(mode);
+    }
+
+    /**
+    Splits voice rendering across worker threads when enabled.
+    */
+    void setParallelRenderingEnabled(bool enabled) noexcept
+    {
+        parallel_rendering_enabled_.store(enabled);
+    }
+
+    /**
+    Records how long getNextAudioBlock() spends on voices, envelopes and
+    mixing. Call before audio starts; stats must outlive the engine's use
+    of it.
+    */
+    void setCallbackStats(AudioCallbackStats* stats) noexcept
+    {
+        callback_stats_ = stats;
+    }
+
+private:
+    struct BlockEvent
+    {
+        MidiEventQueue::Event event;
+        int offset; // sample within the block
+    };
+
+    /**
+    Drains both queues into block_events_, ordered by sample offset. Events
+    that arrived during the previous block land at the same relative
+    position in this one, squeezed to fit if that block ran long. Events
+    deferred from the previous block come first.
+    */
+    void collectBlockEvents(int num_samples) noexcept
+    {
+        const double now = juce::Time::getMillisecondCounterHiRes() * 0.001;
+        const double elapsed = juce::jmax(now - last_block_time_, 1.0e-6);
+        const double start_time = now - elapsed;
+        const double samples_per_second =
+            juce::jmin(sample_rate_, num_samples / elapsed);
+        last_block_time_ = now;
+
+        auto to_offset = [&](const MidiEventQueue::Event& event)
+        {
+            return juce::jlimit(0, num_samples - 1,
+                                (int) ((event.time - start_time)
+                                       * samples_per_second));
+        };
+
+        int num_ui_events = 0;
+        ui_queue_.popAll([&](const MidiEventQueue::Event& event)
+        {
+            ui_events_[num_ui_events++] = { event, to_offset(event) };
+        });
+        int num_midi_events = 0;
+        midi_queue_.popAll([&](const MidiEventQueue::Event& event)
+        {
+            midi_events_[num_midi_events++] = { event, to_offset(event) };
+        });
+
+        num_block_events_ = 0;
+        for (int idx = 0; idx < num_deferred_events_; ++idx)
+            block_events_[num_block_events_++] = { deferred_events_[idx], 0 };
+        num_deferred_events_ = 0;
+
+        // Each queue is already in time order, so a merge is enough
+        int ui_idx = 0, midi_idx = 0;
+        while (ui_idx < num_ui_events || midi_idx < num_midi_events)
+        {
+            bool take_ui = midi_idx == num_midi_events ||
+                (ui_idx < num_ui_events &&
+                 ui_events_[ui_idx].offset <= midi_events_[midi_idx].offset);
+            block_events_[num_block_events_++] =
+                take_ui ? ui_events_[ui_idx++] : midi_events_[midi_idx++];
+        }
+    }
+
+    /**
+    Holds block_events_ from first on over to the next block, in order.
+    Used when an event would touch a voice a late worker is still
+    rendering; everything after it waits too, so no note overtakes another.
+    */
+    void deferEvents(int first) noexcept
+    {
+        const int num_events = num_block_events_ - first;
+        jassert(num_events <= kMaxDeferredEvents); // the excess is dropped
+        num_deferred_events_ = juce::jmin(num_events, kMaxDeferredEvents);
+        for (int idx = 0; idx < num_deferred_events_; ++idx)
+            deferred_events_[idx] = block_events_[first + idx].event;
+    }
+
+    /**
+    Takes up a newly loaded bank and applies the per-block settings.
+    Returns false if there are no voices to render yet.
+    */
+    bool beginBlock() noexcept
+    {
+        // Only switch banks while no worker holds a voice of the old one
+        if (parallel_renderer_.isIdle())
+            adoptPendingBank();
+
+        if (voices_ == nullptr)
+            return false;
+
+        voices_->setGlideTime(glide_time_.load());
+        voices_->setEnvelopeTimingEnabled(callback_stats_ != nullptr);
+        if (fading_bank_ != nullptr)
+            fading_bank_->setEnvelopeTimingEnabled(callback_stats_ != nullptr);
+        voices_->setCloudEnabled(cloud_enabled_.load());
+        voices_->setCloudSettings({ cloud_density_.load(),
+                                    cloud_spray_.load(),
+                                    cloud_position_.load(),
+                                    cloud_length_.load() });
+        allocator_.setStealMode(steal_mode_.load());
+        allocator_.beginBlock([this](int voice) { return voices_->getLevel(voice); },
+                              [this](int voice) { return parallel_renderer_.isVoiceBusy(voice); });
+        followPitch();
+        return true;
+    }
+
+    /**
+    Voices playing the same grain in phase add up in amplitude, so the mix
+    is only kept within kMixHeadroom by dividing by the voice count. Up to
+    kMixFullLevelVoices, every voice plays at the same level.
+    */
+    static float calcMixGain(int num_sounding) noexcept
+    {
+        return kMixHeadroom / (float) juce::jmax(num_sounding, kMixFullLevelVoices);
+    }
+
+    void renderVoices(float* mono_out, int num_samples) noexcept
+    {
+        mix_gain_.setTargetValue(calcMixGain(voices_->getNumActiveVoices()));
+
+        if (parallel_rendering_enabled_.load() || !parallel_renderer_.isIdle())
+            parallel_renderer_.renderNextBlock(*voices_, mono_out, num_samples);
+        else
+            voices_->renderNextBlock(mono_out, num_samples);
+
+        // Voices whose release ended are free for the next note at once
+        voices_->takeFinishedVoices([this](int voice)
+        {
+            allocator_.voiceFinished(voice);
+        });
+
+        if (fading_bank_ != nullptr)
+            mixFadingBank(mono_out, num_samples);
+
+        mix_gain_.applyGain(mono_out, num_samples);
+    }
+
+    /**
+    Resizes every per-voice structure for num_voices voices. Sounding notes
+    stop, and the current bank is rebuilt on the same grain. Not real-time
+    safe.
+    */
+    void setNumVoices(int num_voices)
+    {
+        prepared_num_voices_.store(num_voices);
+        if (num_voices == num_voices_)
+            return;
+
+        num_voices_ = num_voices;
+        allocator_.setNumVoices(num_voices);
+        voice_channel_.assign((size_t) num_voices, 1);
+
+        voices_ = resizeBank(voices_);
+        delete fading_bank_;
+        fading_bank_ = nullptr;
+    }
+
+    /**
+    Returns bank if it already has num_voices_ voices. Otherwise deletes
+    it and returns a silent copy that does. Not real-time safe.
+    */
+    VoiceBank* resizeBank(VoiceBank* bank)
+    {
+        if (bank == nullptr || bank->getNumVoices() == num_voices_)
+            return bank;
+
+        auto resized = bank->withNumVoices(num_voices_);
+        if (envelope_tables_.attack != nullptr)
+            resized->setEnvelope(envelope_, envelope_tables_);
+        resized->prepareToPlay(prepared_block_size_.load(), prepared_sample_rate_.load());
+        delete bank;
+        return resized.release();
+    }
+
+    /**
+    Fades the previous bank out underneath the current one, and retires it
+    once the fade is done. A finished fade with no room in the retire queue
+    keeps the bank, silent, until the message thread has made some.
+    */
+    void mixFadingBank(float* mono_out, int num_samples) noexcept
+    {
+        if (fade_pos_ >= fade_length_)
+        {
+            retireFinishedFade();
+            return;
+        }
+
+        for (int start = 0; start < num_samples; start += fade_buffer_size_)
+        {
+            const int len = juce::jmin(fade_buffer_size_, num_samples - start);
+            fading_bank_->renderNextBlock(fade_buffer_, len);
+
+            float* out = mono_out + start;
+            for (int idx = 0; idx < len; ++idx)
+            {
+                const float gain = juce::jmin((float) (fade_pos_ + idx) / fade_length_,
+                                              1.0f);
+                out[idx] = out[idx] * gain + fade_buffer_[idx] * (1.0f - gain);
+            }
+            fade_pos_ += len;
+
+            if (fade_pos_ >= fade_length_)
+            {
+                retireFinishedFade();
+                return;
+            }
+        }
+    }
+
+    void retireFinishedFade() noexcept
+    {
+        if (retire_fifo_.getFreeSpace() == 0)
+            return;
+
+        retireBank(fading_bank_);
+        fading_bank_ = nullptr;
+    }
+
+    /**
+    Switches to a newly loaded bank, if there is one. Held notes carry over
+    to the new grain. Audio thread only.
+    */
+    void adoptPendingBank() noexcept
+    {
+        if (pending_bank_.load(std::memory_order_relaxed) == nullptr)
+            return;
+
+        // With no room to retire the banks it replaces, the new bank stays
+        // pending until the message thread has deleted some
+        if (retire_fifo_.getFreeSpace() < kMaxBanksRetiredPerSwap)
+            return;
+
+        VoiceBank* next = pending_bank_.exchange(nullptr, std::memory_order_acquire);
+        if (next == nullptr)
+            return;
+
+        // Built for settings an earlier prepareToPlay() replaced; the
+        // message thread loads the grain again when it deletes the bank
+        if (next->getOrigin().generation != generation_.load(std::memory_order_relaxed))
+        {
+            retireBank(next);
+            return;
+        }
+
+        // A fade still in progress is cut short
+        if (fading_bank_ != nullptr)
+        {
+            retireBank(fading_bank_);
+            fading_bank_ = nullptr;
+        }
+
+        fade_length_ = (int) (crossfade_time_.load() * sample_rate_);
+        if (voices_ != nullptr && fade_length_ > 0)
+        {
+            fading_bank_ = voices_;
+            fade_pos_ = 0;
+        }
+        else if (voices_ != nullptr)
+        {
+            retireBank(voices_);
+        }
+        voices_ = next;
+
+        if (envelope_tables_.attack != nullptr)
+            voices_->setEnvelope(envelope_, envelope_tables_);
+
+        // Releases end with the old bank
+        allocator_.freeReleasedVoices();
+        allocator_.forEachHeldNote([this](int note, int voice)
+        {
+            const float pitch = note == kFollowNote
+                ? follow_pitch_
+                : (float) VoiceAllocator::getNoteNumber(note);
+            voices_->setPitch(voice, pitch, pitch);
+            voices_->setPitchBend(voice, calcPitchBend(voice_channel_[voice]));
+            voices_->noteOn(voice, kVoiceAmp);
+        });
+    }
+
+    void deleteRetiredBanks(bool reload_stale)
+    {
+        auto release = [&](VoiceBank* bank)
+        {
+            // Only a bank that was never adopted can still be the latest
+            // load; any other was retired for a newer one
+            if (reload_stale && bank->getOrigin().load == latest_load_.load())
+                requestReload();
+            delete bank;
+        };
+
+        auto scope = retire_fifo_.read(retire_fifo_.getNumReady());
+        for (int idx = 0; idx < scope.blockSize1; ++idx)
+            release(retired_banks_[scope.startIndex1 + idx]);
+        for (int idx = 0; idx < scope.blockSize2; ++idx)
+            release(retired_banks_[scope.startIndex2 + idx]);
+    }
+
+    void requestReload()
+    {
+        if (reload_grain_)
+            reload_grain_();
+        else
+            reloadLatestGrain();
+    }
+
+    /**
+    Hands a bank the audio thread no longer uses to the message thread. The
+    caller makes sure the retire queue has room.
+    */
+    void retireBank(VoiceBank* bank) noexcept
+    {
+        jassert(retire_fifo_.getFreeSpace() > 0);
+        auto scope = retire_fifo_.write(1);
+        retired_banks_[scope.startIndex1] = bank;
+    }
+
+    /**
+    Applies a note on, note off or pitch wheel move. Returns false, having
+    changed nothing, if the message would touch a voice that a worker is
+    still rendering. Audio thread only.
+    */
+    bool applyMIDIMessage(const juce::MidiMessage& message) noexcept
+    {
+        if (message.isNoteOn())
+            return startNote(message.getNoteNumber(), message.getChannel());
+        if (message.isNoteOff())
+            return stopNote(VoiceAllocator::getNote(message.getNoteNumber(),
+                                                    message.getChannel()));
+        if (message.isPitchWheel())
+            return setChannelBend(message.getChannel(), message.getPitchWheelValue());
+        return true;
+    }
+
+    bool startNote(int midiNoteNumber, int midiChannel) noexcept
+    {
+        const int voice = allocateVoice(VoiceAllocator::getNote(midiNoteNumber, midiChannel));
+        if (voice < 0)
+            return false;
+
+        // Glides from the previous note when a glide time is set
+        const float pitch = (float) midiNoteNumber;
+        voices_->setPitch(voice, pitch, last_pitch_ >= 0.0f ? last_pitch_ : pitch);
+        last_pitch_ = pitch;
+
+        voice_channel_[voice] = midiChannel;
+        voices_->setPitchBend(voice, calcPitchBend(midiChannel));
+        voices_->noteOn(voice, kVoiceAmp);
+        return true;
+    }
+
+    /**
+    Stores a channel's pitch wheel position and retunes every voice it
+    affects. In MPE mode the master channel bends every voice. Returns
+    false, changing nothing, if any of those voices is busy.
+    */
+    bool setChannelBend(int midiChannel, int wheel_value) noexcept
+    {
+        const bool bends_all = mpe_enabled_.load() && midiChannel == kMPEMasterChannel;
+        auto is_bent = [&](int voice)
+        {
+            return bends_all || voice_channel_[voice] == midiChannel;
+        };
+
+        if (!parallel_renderer_.isIdle())
+        {
+            for (int voice = 0; voice < num_voices_; ++voice)
+            {
+                if (is_bent(voice) && parallel_renderer_.isVoiceBusy(voice))
+                    return false;
+            }
+        }
+
+        channel_bend_[midiChannel] = (wheel_value - 8192) / 8192.0f;
+        for (int voice = 0; voice < num_voices_; ++voice)
+        {
+            if (is_bent(voice))
+                voices_->setPitchBend(voice, calcPitchBend(voice_channel_[voice]));
+        }
+        return true;
+    }
+
+    float calcPitchBend(int midiChannel) const noexcept
+    {
+        if (!mpe_enabled_.load())
+            return channel_bend_[midiChannel] * kBendRange;
+
+        float bend = channel_bend_[kMPEMasterChannel] * kBendRange;
+        if (midiChannel != kMPEMasterChannel)
+            bend += channel_bend_[midiChannel] * kMPENoteBendRange;
+        return bend;
+    }
+
+    /**
+    Starts, moves or releases the followed note. The pitch glides like a
+    held note does, so the glide time smooths the tracker's output. While
+    its voice is busy the change waits for a later block.
+    */
+    void followPitch() noexcept
+    {
+        int voice = allocator_.getHeldVoice(kFollowNote);
+        if (followed_pitch_ < 0.0f)
+        {
+            if (voice >= 0)
+                stopNote(kFollowNote);
+            return;
+        }
+
+        if (voice >= 0)
+        {
+            if (!parallel_renderer_.isVoiceBusy(voice))
+            {
+                follow_pitch_ = followed_pitch_;
+                voices_->glideTo(voice, follow_pitch_);
+            }
+            return;
+        }
+
+        voice = allocateVoice(kFollowNote);
+        if (voice < 0)
+            return;
+        follow_pitch_ = followed_pitch_;
+        voice_channel_[voice] = 0; // no MIDI channel bends it
+        voices_->setPitch(voice, follow_pitch_, follow_pitch_);
+        voices_->setPitchBend(voice, 0.0f);
+        voices_->noteOn(voice, kVoiceAmp);
+    }
+
+    /**
+    Gives note a voice, taking one from another note if none is free.
+    Returns -1 if only busy voices could be had.
+    */
+    int allocateVoice(int note) noexcept
+    {
+        return allocator_.noteOn(note, [this](int voice)
+        {
+            return parallel_renderer_.isVoiceBusy(voice);
+        });
+    }
+
+    bool stopNote(int note) noexcept
+    {
+        const int held = allocator_.getHeldVoice(note);
+        if (held >= 0 && parallel_renderer_.isVoiceBusy(held))
+            return false;
+
+        const int voice = allocator_.noteOff(note);
+        if (voice >= 0)
+            voices_->noteOff(voice);
+        return true;
+    }
+
+    static const int kVoicesPerCpu = 16;
+    static const int kDefaultBlockSize = 512;
+    static constexpr double kDefaultSampleRate = 48000.0;
+    static constexpr float kVoiceAmp = 1.0f; // the mix gain does the scaling
+    static constexpr float kMixHeadroom = 0.5f; // peak of voices summed in phase
+    static const int kMixFullLevelVoices = 32; // a lone voice plays at 0.5 / 32
+    static constexpr double kMixGainRampTime = 0.05; // seconds
+    ParallelVoiceRenderer parallel_renderer_;
+    std::atomic<bool> parallel_rendering_enabled_ { false };
+    AudioCallbackStats* callback_stats_ = nullptr;
+
+    // Settings applied to whichever bank is current
+    std::atomic<float> glide_time_ { 0.0f }; // seconds
+    std::atomic<bool> period_cache_enabled_ { false }; // for new banks
+    std::atomic<bool> cloud_enabled_ { false };
+    std::atomic<float> cloud_density_ { GrainCloud::Settings().density };
+    std::atomic<float> cloud_spray_ { GrainCloud::Settings().spray };
+    std::atomic<float> cloud_position_ { GrainCloud::Settings().position };
+    std::atomic<float> cloud_length_ { GrainCloud::Settings().length };
+    CustomADSR::Parameters envelope_;
+    CustomADSR::Tables envelope_tables_; // from the latest parameter snapshot
+
+    // Begin bank hand-over
+    static const int kMaxRetiredBanks = 16;
+    static const int kMaxBanksRetiredPerSwap = 2; // the fading bank and the current one
+    VoiceBank* voices_ = nullptr; // audio thread only
+    VoiceBank* fading_bank_ = nullptr; // audio thread only
+    std::atomic<VoiceBank*> pending_bank_ { nullptr };
+    juce::AbstractFifo retire_fifo_ { kMaxRetiredBanks };
+    VoiceBank* retired_banks_[kMaxRetiredBanks];
+    std::atomic<float> crossfade_time_ { 0.02f }; // seconds
+    juce::HeapBlock<float> fade_buffer_;
+    int fade_buffer_size_ = 0;
+    int fade_pos_ = 0;
+    int fade_length_ = 0; // samples
+    std::atomic<int> prepared_block_size_ { kDefaultBlockSize };
+    std::atomic<double> prepared_sample_rate_ { kDefaultSampleRate };
+    std::atomic<int> generation_ { 0 }; // bumped by every prepareToPlay()
+    std::atomic<int> latest_load_ { 0 }; // counts loadGrain() calls
+    std::function<void()> reload_grain_; // message thread
+    juce::CriticalSection load_lock_; // never taken by the audio thread
+    GrainTable::Ptr latest_grain_;
+    CustomADSR::Parameters latest_envelope_;
+    // End bank hand-over
+
+    static const int kFollowNote = VoiceAllocator::kFollowNote;
+    std::atomic<int> polyphony_ { kDefaultPolyphony }; // from the next prepareToPlay()
+    std::atomic<int> prepared_num_voices_ { kDefaultPolyphony }; // size of new banks
+    int num_voices_ = 0; // audio thread only
+    VoiceAllocator allocator_ { kDefaultPolyphony }; // audio thread only
+    juce::SmoothedValue<float> mix_gain_; // audio thread only
+    std::atomic<VoiceAllocator::StealMode> steal_mode_ { VoiceAllocator::StealMode::oldest };
+
+    // Begin pitch modulation
+    static constexpr float kBendRange = 2.0f; // semitones
+    static constexpr float kMPENoteBendRange = 48.0f; // semitones
+    static const int kMPEMasterChannel = 1;
+    std::atomic<bool> mpe_enabled_ { false };
+    float channel_bend_[17] = { 0.0f }; // -1 to 1, indexed by MIDI channel
+    std::vector<int> voice_channel_;
+    float last_pitch_ = -1.0f;
+    float followed_pitch_ = -1.0f; // set each block, negative when not following
+    float follow_pitch_ = 0.0f; // last pitch given to the followed note
+    // End pitch modulation
+
+    // Begin MIDI event path; the queues are the only state shared with
+    // other threads
+    MidiEventQueue ui_queue_; // on-screen keyboard, message thread
+    MidiEventQueue midi_queue_; // MIDI input thread
+    BlockEvent ui_events_[MidiEventQueue::kCapacity];
+    BlockEvent midi_events_[MidiEventQueue::kCapacity];
+    static const int kMaxDeferredEvents = 2 * MidiEventQueue::kCapacity;
+    MidiEventQueue::Event deferred_events_[kMaxDeferredEvents]; // for the next block
+    int num_deferred_events_ = 0;
+    BlockEvent block_events_[kMaxDeferredEvents + 2 * MidiEventQueue::kCapacity];
+    int num_block_events_ = 0;
+    double sample_rate_ = kDefaultSampleRate;
+    double last_block_time_ = 0.0; // seconds
+    // End MIDI event path
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SynthEngine)
+};
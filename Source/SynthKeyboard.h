@@ -1,109 +1,47 @@
 #pragma once
 
 #include <JuceHeader.h>
-#include "GrainSynth.h"
-
-#include <map>
-
-using std::unordered_map;
+#include "SynthEngine.h"
 
 //==============================================================================
 /*
+    The on-screen keyboard. Notes played on it go to a SynthEngine, and its
+    timer deletes the banks the engine has retired.
 */
 class SynthKeyboard  : public juce::Component,
                        public juce::MidiKeyboardState::Listener,
-                       public juce::AudioSource
+                       private juce::Timer
 {
 public:
-    SynthKeyboard(const juce::AudioSampleBuffer& grain,
-                  float grain_freq)
+    explicit SynthKeyboard(SynthEngine& engine) :
+        engine_(engine)
     {
         midi_keyboard_state_.addListener(this);
         midi_keyboard_.reset(new juce::MidiKeyboardComponent(midi_keyboard_state_,
                             juce::KeyboardComponentBase::Orientation::horizontalKeyboard));
+        midi_keyboard_->setAvailableRange(SynthEngine::kLowestNote, SynthEngine::kHighestNote);
         addAndMakeVisible(midi_keyboard_.get());
 
-        for (int voice_idx = 0; voice_idx < max_voices_; ++voice_idx)
-        {
-            auto* synth = new GrainSynth(grain, grain_freq); // TODO
-            mixer_.addInputSource(synth, false);
-            free_voices_[num_free_voices_++] = synth;
-            voices_.add(synth);
-        }
-    }
-
-    virtual ~SynthKeyboard() = default;
-
-    //==========================================================================
-    // External MIDI
-
-    void processMIDIMessage(const juce::MidiMessage& message)
-    {
-        if (message.isNoteOn())
-        {
-            handleNoteOn(nullptr,
-                         message.getChannel(),
-                         message.getNoteNumber(),
-                         message.getVelocity());
-        }
-        else if (message.isNoteOff())
-        {
-            handleNoteOff(nullptr,
-                          message.getChannel(),
-                          message.getNoteNumber(),
-                          message.getVelocity());
-        }
-    }
- 
-
-    //==========================================================================
-    // AudioSource
- 
-    virtual void prepareToPlay(int samplesPerBlockExpected, double sampleRate) override
-    {
-        mixer_.prepareToPlay(samplesPerBlockExpected, sampleRate);
-    }
- 
-    virtual void releaseResources() override
-    {
-        mixer_.releaseResources();
+        startTimer(kRetireIntervalMs);
     }
 
-    virtual void getNextAudioBlock(const juce::AudioSourceChannelInfo& bufferToFill) override
+    virtual ~SynthKeyboard()
     {
-        mixer_.getNextAudioBlock(bufferToFill);
+        stopTimer();
+        midi_keyboard_state_.removeListener(this);
     }
 
     //==========================================================================
     // MidiKeyboardState::Listener
 
-    static constexpr inline float midiToFreq(juce::uint8 midi_note)
-    {
-        return 440.0 * std::pow(2.0, (midi_note - 69) / 12.0);
-    }
-
     virtual void handleNoteOn(juce::MidiKeyboardState *source,
                               int midiChannel,
                               int midiNoteNumber,
                               float velocity) override
     {
-        checkOffVoices();
-
-        if (voice_mapping_.find(midiNoteNumber) != voice_mapping_.end())
-        {
-            voice_mapping_[midiNoteNumber]->setFrequency(
-                (juce::uint8) midiToFreq(midiNoteNumber));
-        }
-        else if (num_free_voices_ > 0)
-        {
-            auto* voice = free_voices_[num_free_voices_ - 1];
-            voice_mapping_[midiNoteNumber] = voice;
-            auto freq = midiToFreq((juce::uint8) midiNoteNumber);
-            voice->setFrequency(freq);
-            voice->noteOn(0.5 / max_voices_);
-            free_voices_[num_free_voices_ - 1] = nullptr;
-            --num_free_voices_;
-        }
+        engine_.processUIMessage(juce::MidiMessage::noteOn(midiChannel,
+                                                           midiNoteNumber,
+                                                           velocity));
     }
 
     virtual void handleNoteOff(juce::MidiKeyboardState *source,
@@ -111,14 +49,9 @@ public:
                                int midiNoteNumber,
                                float velocity) override
     {
-        std::unordered_map<int, GrainSynth*>::iterator iter;
-        if ((iter = voice_mapping_.find(midiNoteNumber)) != voice_mapping_.end())
-        {
-            auto* voice = voice_mapping_[midiNoteNumber];
-            voice->noteOff();
-            voice_mapping_.erase(iter);
-            addOffVoice(voice);
-        }
+        engine_.processUIMessage(juce::MidiMessage::noteOff(midiChannel,
+                                                            midiNoteNumber,
+                                                            velocity));
     }
 
     //==========================================================================
@@ -131,44 +64,15 @@ public:
         midi_keyboard_->setBounds(getLocalBounds());
     }
 
-    juce::OwnedArray<GrainSynth>& getVoices()
-    {
-        return voices_; // sorry, this is a hack
-    }
-
 private:
-    // Could make this faster with multithreading
-    forcedinline void checkOffVoices()
-    {
-        GrainSynth* voice;
-        if (num_off_voices_ > 0 &&
-            !(voice = off_voices_[ov_start_idx_])->isActive())
-        {
-            free_voices_[num_free_voices_++] = voice;
-            off_voices_[ov_start_idx_] = nullptr;
-            ov_start_idx_ = (ov_start_idx_ + 1) % max_voices_;
-            --num_off_voices_;
-        }
-    }
-
-    void addOffVoice(GrainSynth* voice)
+    void timerCallback() override
     {
-        off_voices_[ov_end_idx_] = voice;
-        ov_end_idx_ = (ov_end_idx_ + 1) % max_voices_;
-        ++num_off_voices_;
+        engine_.releaseRetiredBanks();
     }
 
-    static const int max_voices_ = 32;
-    juce::OwnedArray<GrainSynth> voices_;
-    juce::MixerAudioSource mixer_;
+    static const int kRetireIntervalMs = 100;
 
-    int num_off_voices_ = 0;
-    int ov_start_idx_ = 0;
-    int ov_end_idx_ = 0;
-    GrainSynth* off_voices_[max_voices_]; // voices turned off, but release not yet finished
-    int num_free_voices_ = 0;
-    GrainSynth* free_voices_[max_voices_]; // voices ready to be used
-    unordered_map<int, GrainSynth*> voice_mapping_;
+    SynthEngine& engine_;
 
     juce::MidiKeyboardState midi_keyboard_state_;
     std::unique_ptr<juce::MidiKeyboardComponent> midi_keyboard_;
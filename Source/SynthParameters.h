@@ -0,0 +1,174 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+#include "CustomADSR.h"
+#include "EnvelopeTableCache.h"
+
+//==============================================================================
+/*
+    Control settings that the UI writes and the audio thread reads.
+
+    Every change builds a complete Snapshot on the writing thread, including
+    envelope tables and filter coefficients, in one of three slots. The
+    audio thread picks up the newest snapshot at the start of a block by
+    swapping one index, so it never locks, allocates or waits on the UI.
+*/
+class SynthParameters
+{
+public:
+    struct Settings
+    {
+        float attack = 0.1f; // seconds
+        float decay = 0.1f; // seconds
+        float sustain = 0.9f; // fraction of full level
+        float release = 0.1f; // seconds
+        float cutoff = 1000.0f; // Hz
+    };
+
+    struct Snapshot
+    {
+        CustomADSR::Parameters envelope;
+        CustomADSR::Tables envelope_tables; // owned by the snapshot
+        juce::IIRCoefficients lowpass;
+
+    private:
+        friend class SynthParameters;
+        EnvelopeTableCache::TablePtr attack_table_, decay_table_, release_table_;
+    };
+
+    SynthParameters()
+    {
+        publish();
+    }
+
+    //==========================================================================
+    // Writer side, any thread but the audio thread
+
+    void setAttack(float seconds)    { update([=] (Settings& s) { s.attack = seconds; }); }
+    void setDecay(float seconds)     { update([=] (Settings& s) { s.decay = seconds; }); }
+    void setSustain(float fraction)  { update([=] (Settings& s) { s.sustain = fraction; }); }
+    void setRelease(float seconds)   { update([=] (Settings& s) { s.release = seconds; }); }
+    void setCutoff(float hz)         { update([=] (Settings& s) { s.cutoff = hz; }); }
+
+    void setSampleRate(double sampleRate)
+    {
+        const std::lock_guard<std::mutex> lock(write_mutex_);
+        sample_rate_ = sampleRate;
+        publish();
+    }
+
+    Settings getSettings()
+    {
+        const std::lock_guard<std::mutex> lock(write_mutex_);
+        return settings_;
+    }
+
+    /**
+    Envelope parameters for the current settings, for setting up new voices.
+    */
+    CustomADSR::Parameters getEnvelopeParameters()
+    {
+        const std::lock_guard<std::mutex> lock(write_mutex_);
+        return makeEnvelopeParameters(settings_);
+    }
+
+    juce::IIRCoefficients getLowpassCoefficients()
+    {
+        const std::lock_guard<std::mutex> lock(write_mutex_);
+        return juce::IIRCoefficients::makeLowPass(sample_rate_, settings_.cutoff);
+    }
+
+    //==========================================================================
+    // Reader side, audio thread only
+
+    /**
+    Switches to the newest snapshot. Returns false if nothing has changed
+    since the last call.
+    */
+    bool pullSnapshot() noexcept
+    {
+        if ((middle_.load(std::memory_order_relaxed) & kFresh) == 0)
+            return false;
+
+        front_ = middle_.exchange(front_, std::memory_order_acq_rel) & kIndexMask;
+        return true;
+    }
+
+    /**
+    The snapshot taken by the last pullSnapshot(). It stays valid, tables
+    included, until the next call.
+    */
+    const Snapshot& getSnapshot() const noexcept
+    {
+        return slots_[front_];
+    }
+
+private:
+    template <typename Change>
+    void update(Change change)
+    {
+        const std::lock_guard<std::mutex> lock(write_mutex_);
+        change(settings_);
+        publish();
+    }
+
+    static CustomADSR::Parameters makeEnvelopeParameters(const Settings& settings)
+    {
+        CustomADSR::Parameters envelope(settings.attack,
+                                        settings.decay,
+                                        settings.sustain,
+                                        settings.release,
+                                        kEnvelopeResolution);
+        envelope.attackEnv = CustomADSR::Parameters::EXP_GRO_ENV<4, 1>;
+        envelope.decayEnv = CustomADSR::Parameters::EXP_DEC_ENV<3, 1>;
+        envelope.releaseEnv = CustomADSR::Parameters::EXP_DEC_ENV<3, 1>;
+        return envelope;
+    }
+
+    // Fills the back slot and hands it over. Called with write_mutex_ held.
+    void publish()
+    {
+        Snapshot& snapshot = slots_[back_];
+        auto& cache = EnvelopeTableCache::getInstance();
+
+        snapshot.envelope = makeEnvelopeParameters(settings_);
+        snapshot.attack_table_ = cache.getTable(snapshot.envelope.attackEnv,
+                                                kEnvelopeResolution,
+                                                settings_.attack,
+                                                sample_rate_);
+        snapshot.decay_table_ = cache.getTable(snapshot.envelope.decayEnv,
+                                               kEnvelopeResolution,
+                                               settings_.decay,
+                                               sample_rate_);
+        snapshot.release_table_ = cache.getTable(snapshot.envelope.releaseEnv,
+                                                 kEnvelopeResolution,
+                                                 settings_.release,
+                                                 sample_rate_);
+        snapshot.envelope_tables = { snapshot.attack_table_.get(),
+                                     snapshot.decay_table_.get(),
+                                     snapshot.release_table_.get() };
+        snapshot.lowpass = juce::IIRCoefficients::makeLowPass(sample_rate_,
+                                                              settings_.cutoff);
+
+        back_ = middle_.exchange(back_ | kFresh, std::memory_order_acq_rel)
+            & kIndexMask;
+    }
+
+    static const int kEnvelopeResolution = 256;
+    static const int kIndexMask = 3;
+    static const int kFresh = 4; // set on middle_ until the reader takes it
+
+    std::mutex write_mutex_;
+    Settings settings_;
+    double sample_rate_ = 48000.0;
+
+    // Triple buffer: the writer owns back_, the reader owns front_, and
+    // the two trade through middle_
+    Snapshot slots_[3];
+    int back_ = 0;
+    std::atomic<int> middle_ { 1 };
+    int front_ = 2;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SynthParameters)
+};
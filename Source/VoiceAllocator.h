@@ -0,0 +1,354 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/*
+    Decides which voice plays each note. Every voice is on exactly one of
+    three lists: free, held (note still down) or released (note up, release
+    still sounding). The lists are linked through per-voice arrays, so every
+    move between them is constant time and nothing is ever scanned per note.
+
+    A note is a MIDI note number on one channel, so the same key held on
+    two channels, as MPE controllers do, takes two voices.
+
+    When no voice is free, one is stolen according to the StealMode. A
+    released voice finishes when the bank says its envelope is done, and is
+    then freed by voiceFinished(). A voice another thread is still rendering
+    is never handed out.
+
+    For quietest stealing, sounding voices are sorted into level buckets
+    kLevelBucketDecibels wide once per block, in beginBlock(). A steal then
+    takes the head of the lowest non-empty bucket, so the voice is the
+    quietest to within one bucket and no note scans or sorts the voices.
+
+    Not thread safe; the audio thread owns it.
+*/
+class VoiceAllocator
+{
+public:
+    enum class StealMode
+    {
+        oldest, // the voice released longest ago, else the oldest held note
+        quietest, // the voice with the lowest envelope level
+        sameNote // a voice still releasing the same note is retriggered;
+                 // otherwise as oldest
+    };
+
+    static const int kNumChannels = 16;
+    static const int kNotesPerChannel = 128;
+    static const int kNumNotes = kNumChannels * kNotesPerChannel + 1;
+    static const int kFollowNote = kNumNotes - 1; // a note not played from MIDI
+
+    /**
+    The note for a MIDI note number on a channel from 1 to 16.
+    */
+    static int getNote(int note_number, int channel) noexcept
+    {
+        return (juce::jlimit(1, kNumChannels, channel) - 1) * kNotesPerChannel + note_number;
+    }
+
+    /**
+    The MIDI note number a note other than kFollowNote plays.
+    */
+    static int getNoteNumber(int note) noexcept
+    {
+        return note % kNotesPerChannel;
+    }
+
+    explicit VoiceAllocator(int num_voices)
+    {
+        setNumVoices(num_voices);
+    }
+
+    /**
+    Resizes for num_voices voices, all free. Allocates.
+    */
+    void setNumVoices(int num_voices)
+    {
+        num_voices_ = num_voices;
+        next_.assign((size_t) num_voices, -1);
+        prev_.assign((size_t) num_voices, -1);
+        state_.assign((size_t) num_voices, kFree);
+        note_.assign((size_t) num_voices, -1);
+        level_next_.assign((size_t) num_voices, -1);
+        level_prev_.assign((size_t) num_voices, -1);
+        level_bucket_.assign((size_t) num_voices, -1);
+        std::fill(std::begin(level_heads_), std::end(level_heads_), -1);
+
+        std::fill(std::begin(voice_for_note_), std::end(voice_for_note_), -1);
+        for (auto& list : lists_)
+            list = List();
+        for (int voice = 0; voice < num_voices_; ++voice)
+            append(kFree, voice);
+    }
+
+    int getNumVoices() const noexcept
+    {
+        return num_voices_;
+    }
+
+    void setStealMode(StealMode mode) noexcept
+    {
+        steal_mode_ = mode;
+    }
+
+    /**
+    Call at the start of every audio block. In quietest mode, re-buckets
+    every sounding voice by level_of(voice), its current envelope level.
+    Busy voices are still changing level, so they sit this block out.
+    */
+    template <typename LevelFunction, typename BusyFunction>
+    void beginBlock(LevelFunction&& level_of, BusyFunction&& is_busy) noexcept
+    {
+        if (steal_mode_ != StealMode::quietest)
+            return;
+
+        // Free voices are never in a bucket, so only sounding ones are reset
+        std::fill(std::begin(level_heads_), std::end(level_heads_), -1);
+        for (const State state : { kReleased, kHeld })
+        {
+            for (int voice = lists_[state].head; voice >= 0; voice = next_[voice])
+            {
+                level_bucket_[voice] = -1;
+                if (!is_busy(voice))
+                    addToLevelBucket(voice, getLevelBucket(level_of(voice)));
+            }
+        }
+    }
+
+    /**
+    Gives note a voice and marks it held: the voice already holding the
+    note, a free voice, or a stolen one, in that order. is_busy(voice) is
+    true while a voice is still being rendered; such a voice is left alone.
+    Returns -1, changing nothing, if the note's own voice is busy or every
+    voice that could be stolen is.
+    */
+    template <typename BusyFunction>
+    int noteOn(int note, BusyFunction&& is_busy) noexcept
+    {
+        int voice = voice_for_note_[note];
+        bool reuse = voice >= 0 &&
+            (state_[voice] == kHeld ||
+             (state_[voice] == kReleased && steal_mode_ == StealMode::sameNote));
+
+        if (reuse && is_busy(voice))
+        {
+            // A held note keeps its voice; a releasing one can move
+            if (state_[voice] == kHeld)
+                return -1;
+            reuse = false;
+        }
+
+        if (!reuse)
+        {
+            // Voices are only freed once rendered, so a free one is never busy
+            if (lists_[kFree].head >= 0)
+                voice = lists_[kFree].head;
+            else
+                voice = chooseVictim(is_busy);
+            if (voice < 0)
+                return -1;
+
+            if (state_[voice] != kFree && voice_for_note_[note_[voice]] == voice)
+                voice_for_note_[note_[voice]] = -1;
+        }
+
+        // A restarted voice is no longer quiet; it is bucketed again next
+        // block. Moving to the tail of held keeps that list in note on order.
+        removeFromLevelBucket(voice);
+        move(voice, kHeld);
+        note_[voice] = note;
+        voice_for_note_[note] = voice;
+        return voice;
+    }
+
+    /**
+    Moves the voice holding note to the released list. Returns that voice,
+    or -1 if the note holds none, e.g. because it was stolen.
+    */
+    int noteOff(int note) noexcept
+    {
+        const int voice = getHeldVoice(note);
+        if (voice >= 0)
+            move(voice, kReleased);
+        return voice;
+    }
+
+    /**
+    Frees a voice whose envelope has finished. Held and already free voices
+    are left alone, so a late report for a voice that has since been
+    retriggered does no harm.
+    */
+    void voiceFinished(int voice) noexcept
+    {
+        if (state_[voice] != kReleased)
+            return;
+
+        if (voice_for_note_[note_[voice]] == voice)
+            voice_for_note_[note_[voice]] = -1;
+        removeFromLevelBucket(voice);
+        move(voice, kFree);
+    }
+
+    /**
+    Frees every released voice at once, for when the voices they were
+    sounding on have gone.
+    */
+    void freeReleasedVoices() noexcept
+    {
+        while (lists_[kReleased].head >= 0)
+            voiceFinished(lists_[kReleased].head);
+    }
+
+    /**
+    The voice holding note, or -1.
+    */
+    int getHeldVoice(int note) const noexcept
+    {
+        const int voice = voice_for_note_[note];
+        return voice >= 0 && state_[voice] == kHeld ? voice : -1;
+    }
+
+    /**
+    Calls callback(note, voice) for every held note, oldest first.
+    */
+    template <typename Callback>
+    void forEachHeldNote(Callback&& callback) const
+    {
+        for (int voice = lists_[kHeld].head; voice >= 0; voice = next_[voice])
+            callback(note_[voice], voice);
+    }
+
+private:
+    enum State
+    {
+        kFree,
+        kHeld,
+        kReleased,
+        kNumStates
+    };
+
+    struct List
+    {
+        int head = -1;
+        int tail = -1;
+    };
+
+    /**
+    The voice to steal, or -1 if every sounding voice is busy. At most one
+    voice per render thread is busy, so skipping them is cheap.
+    */
+    template <typename BusyFunction>
+    int chooseVictim(BusyFunction&& is_busy) noexcept
+    {
+        if (steal_mode_ == StealMode::quietest)
+        {
+            for (const int head : level_heads_)
+            {
+                for (int voice = head; voice >= 0; voice = level_next_[voice])
+                {
+                    if (!is_busy(voice))
+                        return voice;
+                }
+            }
+        }
+
+        // Cutting a note that is already fading is least noticeable
+        for (const State state : { kReleased, kHeld })
+        {
+            for (int voice = lists_[state].head; voice >= 0; voice = next_[voice])
+            {
+                if (!is_busy(voice))
+                    return voice;
+            }
+        }
+        return -1;
+    }
+
+    static int getLevelBucket(float level) noexcept
+    {
+        const float decibels = juce::Decibels::gainToDecibels(level, kQuietestDecibels);
+        return juce::jlimit(0, kNumLevelBuckets - 1,
+                            (int) ((decibels - kQuietestDecibels) / kLevelBucketDecibels));
+    }
+
+    void addToLevelBucket(int voice, int bucket) noexcept
+    {
+        level_bucket_[voice] = bucket;
+        level_prev_[voice] = -1;
+        level_next_[voice] = level_heads_[bucket];
+        if (level_heads_[bucket] >= 0)
+            level_prev_[level_heads_[bucket]] = voice;
+        level_heads_[bucket] = voice;
+    }
+
+    void removeFromLevelBucket(int voice) noexcept
+    {
+        const int bucket = level_bucket_[voice];
+        if (bucket < 0)
+            return;
+
+        if (level_prev_[voice] >= 0)
+            level_next_[level_prev_[voice]] = level_next_[voice];
+        else
+            level_heads_[bucket] = level_next_[voice];
+        if (level_next_[voice] >= 0)
+            level_prev_[level_next_[voice]] = level_prev_[voice];
+        level_bucket_[voice] = -1;
+    }
+
+    void move(int voice, State state) noexcept
+    {
+        unlink(voice);
+        append(state, voice);
+    }
+
+    void append(State state, int voice) noexcept
+    {
+        auto& list = lists_[state];
+        state_[voice] = state;
+        prev_[voice] = list.tail;
+        next_[voice] = -1;
+        if (list.tail >= 0)
+            next_[list.tail] = voice;
+        else
+            list.head = voice;
+        list.tail = voice;
+    }
+
+    void unlink(int voice) noexcept
+    {
+        auto& list = lists_[state_[voice]];
+        if (prev_[voice] >= 0)
+            next_[prev_[voice]] = next_[voice];
+        else
+            list.head = next_[voice];
+        if (next_[voice] >= 0)
+            prev_[next_[voice]] = prev_[voice];
+        else
+            list.tail = prev_[voice];
+    }
+
+    int num_voices_ = 0;
+    StealMode steal_mode_ = StealMode::oldest;
+
+    // Per voice
+    std::vector<int> next_;
+    std::vector<int> prev_;
+    std::vector<State> state_;
+    std::vector<int> note_; // the note it plays or last played
+    List lists_[kNumStates];
+    int voice_for_note_[kNumNotes]; // voice last given each note, or -1
+
+    // Sounding voices by level, quietest bucket first, rebuilt every block
+    static const int kNumLevelBuckets = 16;
+    static constexpr float kLevelBucketDecibels = 6.0f;
+    static constexpr float kQuietestDecibels = -kNumLevelBuckets * kLevelBucketDecibels;
+    std::vector<int> level_next_;
+    std::vector<int> level_prev_;
+    std::vector<int> level_bucket_; // -1 when not in a bucket
+    int level_heads_[kNumLevelBuckets];
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (VoiceAllocator)
+};
@@ -0,0 +1,846 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+#include "CustomADSR.h"
+#include "GrainCloud.h"
+#include "GrainTable.h"
+
+//==============================================================================
+/*
+    Every voice of the synth in one object. Per-voice state is kept in
+    arrays indexed by voice number, allocated up front, and all voices are
+    rendered into one shared mono bus in a single pass. The scalar arrays
+    and the period cache share one block; the grain ring buffers, envelopes
+    and grain clouds are held separately.
+*/
+class VoiceBank
+{
+public:
+    /**
+    With period_cache, the bank sets aside room for each voice to cache a
+    cycle of its grain pattern; see hasPeriodCache().
+    */
+    VoiceBank(GrainTable::Ptr grain,
+              int num_voices,
+              const CustomADSR::Parameters& envelope,
+              bool period_cache = false) :
+        grain_(grain),
+        grain_data_(grain->getReadPointer()),
+        grain_source_(grain->getSourcePointer()),
+        table_size_(grain->getNumSamples()),
+        grain_freq_(grain->getGrainFrequency()),
+        num_voices_(num_voices),
+        grain_idx_ringbuf_(num_voices * grain_pool_size_, 0),
+        grain_data_ringbuf_(num_voices * grain_pool_size_, grain_data_),
+        adsr_parameters_(envelope),
+        adsr_(num_voices, CustomADSR(adsr_parameters_)),
+        cloud_(num_voices),
+        has_period_cache_(period_cache)
+    {
+        // Lay the arrays out once to size the block, then again to place
+        // them in it
+        voice_storage_.calloc(layOutVoiceStorage(nullptr) + kStorageAlignment);
+        layOutVoiceStorage(juce::snapPointerToAlignment(voice_storage_.get(),
+                                                        (size_t) kStorageAlignment));
+
+        std::fill_n(pitch_, num_voices_, 69.0f);
+        std::fill_n(target_pitch_, num_voices_, 69.0f);
+        std::fill_n(curr_num_grains_, num_voices_, 1);
+        std::fill_n(active_voices_, num_voices_, -1);
+        std::fill_n(finished_voices_, num_voices_, -1);
+
+        voice_buffer_.setSize(1, kDefaultBlockSize);
+    }
+
+    ~VoiceBank() = default;
+
+    int getNumVoices() const noexcept
+    {
+        return num_voices_;
+    }
+
+    const GrainTable* getGrain() const noexcept
+    {
+        return grain_.get();
+    }
+
+    /**
+    Which load and which prepareToPlay() of its owner a bank was built
+    for. The owner sets it; the bank only carries it.
+    */
+    struct Origin
+    {
+        int load = 0;
+        int generation = 0;
+    };
+
+    void setOrigin(Origin origin) noexcept
+    {
+        origin_ = origin;
+    }
+
+    Origin getOrigin() const noexcept
+    {
+        return origin_;
+    }
+
+    /**
+    A silent bank on the same grain and envelope, with num_voices voices.
+    The caller prepares it to play. Allocates.
+    */
+    std::unique_ptr<VoiceBank> withNumVoices(int num_voices) const
+    {
+        auto bank = std::make_unique<VoiceBank>(grain_, num_voices, adsr_parameters_,
+                                                has_period_cache_);
+        bank->grain_data_ = grain_data_;
+        bank->grain_source_ = grain_source_;
+        bank->origin_ = origin_;
+        bank->setGrainPoolSize(grain_pool_size_);
+        return bank;
+    }
+
+    /**
+    Switches new grains to other samples with the same length and base
+    frequency as the bank's table, as LiveGranulator produces, with source
+    the same samples unwindowed for grain clouds. Grains in flight finish
+    on the samples they started with, so the caller keeps those unchanged
+    for the length of a grain. Real-time safe, but must not run while any
+    voice is being rendered.
+    */
+    void setGrainData(const float* data, const float* source) noexcept
+    {
+        grain_data_ = data;
+        grain_source_ = source;
+        for (int voice = 0; voice < num_voices_; ++voice)
+            leavePeriodCache(voice);
+    }
+
+    //==========================================================================
+    // Per-voice control
+
+    void noteOn(int voice, float amp)
+    {
+        adsr_[voice].noteOn();
+        amp_[voice] = amp;
+        cloud_.resetVoice(voice);
+
+        if (!is_voice_listed_[voice])
+        {
+            is_voice_listed_[voice] = 1;
+            active_voices_[num_active_voices_++] = voice;
+        }
+    }
+
+    void noteOff(int voice)
+    {
+        adsr_[voice].noteOff();
+    }
+
+    /**
+    Sets the pitch a voice plays, as a fractional MIDI note number. The voice
+    glides from start_pitch to pitch over the glide time; pass the same value
+    twice to jump straight there. Never allocates, so it is safe to call from
+    the audio thread on every note on.
+    */
+    void setPitch(int voice, float pitch, float start_pitch) noexcept
+    {
+        target_pitch_[voice] = pitch;
+        pitch_[voice] = start_pitch;
+    }
+
+    /**
+    Moves a voice's target pitch, gliding from wherever it is now.
+    */
+    void glideTo(int voice, float pitch) noexcept
+    {
+        target_pitch_[voice] = pitch;
+    }
+
+    /**
+    Offsets a voice's pitch by a number of semitones, from the next block.
+    */
+    void setPitchBend(int voice, float semitones) noexcept
+    {
+        pitch_bend_[voice] = semitones;
+    }
+
+    /**
+    How long a voice takes to get most of the way to a new pitch.
+    */
+    void setGlideTime(float seconds) noexcept
+    {
+        glide_time_.store(seconds);
+    }
+
+    bool isActive(int voice) const
+    {
+        return adsr_[voice].isActive();
+    }
+
+    /**
+    A voice's current envelope level, for picking the quietest one.
+    */
+    float getLevel(int voice) const noexcept
+    {
+        return adsr_[voice].getLevel();
+    }
+
+    int getNumActiveVoices() const noexcept
+    {
+        return num_active_voices_;
+    }
+
+    struct OverlapStats
+    {
+        int grain_pool_size; // grain slots per voice
+        int peak_num_grains; // most grains any voice has had in flight
+        int dropped_grains; // grains retired early, or clouds not started, because a pool was full
+    };
+
+    /**
+    Safe to call from any thread while the bank is rendering.
+    */
+    OverlapStats getOverlapStats() const noexcept
+    {
+        return { grain_pool_size_,
+                 overlap_peak_.load(),
+                 overlap_dropped_.load() };
+    }
+
+    /**
+    Sizes every voice's grain pool for the highest frequency that will be
+    played. Grains are triggered twice per grain period, so a note overlaps
+    2 * freq / grain_freq grains. Not real-time safe; restarts every voice's
+    grains.
+    */
+    void setHighestFrequency(float highest_freq)
+    {
+        int needed = (int) std::ceil(2.0f * highest_freq / grain_freq_) + 2;
+        setGrainPoolSize(juce::nextPowerOfTwo(juce::jmax(needed, kMinGrainPoolSize)));
+    }
+
+    /**
+    True if the bank was built with a period cache. Then a voice whose
+    grain pattern has settled renders one cycle of it into a cache and plays
+    that back until its pitch changes. The cycle length is rounded to whole
+    samples, which may detune a note by up to kMaxCacheDetune.
+    */
+    bool hasPeriodCache() const noexcept
+    {
+        return has_period_cache_;
+    }
+
+    /**
+    When enabled, voices play asynchronous grain clouds instead of
+    pitch-synchronous grains.
+    */
+    void setCloudEnabled(bool enabled) noexcept
+    {
+        cloud_.setEnabled(enabled);
+    }
+
+    void setCloudSettings(const GrainCloud::Settings& settings) noexcept
+    {
+        cloud_.setSettings(settings);
+    }
+
+    //==========================================================================
+    // Envelope parameters, shared by every voice
+
+    /**
+    Retunes every envelope in place; sounding notes carry on from their
+    current level. Real-time safe, but must not run while any voice is
+    being rendered. The caller keeps tables alive until the next call.
+    */
+    void setEnvelope(const CustomADSR::Parameters& envelope,
+                     const CustomADSR::Tables& tables) noexcept
+    {
+        adsr_parameters_ = envelope;
+        for (auto& adsr : adsr_)
+        {
+            adsr.setParameters(envelope, tables);
+        }
+    }
+
+    //==========================================================================
+    // Rendering
+
+    /**
+    Calculates the trigger interval of every voice and sizes the scratch
+    buffer. Not real-time safe.
+    */
+    void prepareToPlay(int samplesPerBlockExpected, double sampleRate)
+    {
+        sample_rate_ = sampleRate;
+        voice_buffer_.setSize(1, juce::jmax(samplesPerBlockExpected,
+                                            kDefaultBlockSize));
+        cloud_.prepare(sampleRate);
+        for (int voice = 0; voice < num_voices_; ++voice)
+        {
+            leavePeriodCache(voice);
+            trigger_samples_[voice] =
+                calcTriggerSamples(pitch_[voice] + pitch_bend_[voice]);
+            adsr_[voice].setSampleRate(sampleRate);
+        }
+    }
+
+    /**
+    Overwrites mono_out with the sum of every sounding voice. Voices whose
+    envelope has finished are dropped from the active list afterwards.
+    */
+    void renderNextBlock(float* mono_out, int num_samples) noexcept
+    {
+        juce::FloatVectorOperations::clear(mono_out, num_samples);
+
+        const int chunk_size = voice_buffer_.getNumSamples();
+        auto* voice_out = voice_buffer_.getWritePointer(0);
+        juce::int64 envelope_ticks = 0;
+        auto* timing = isEnvelopeTimingEnabled() ? &envelope_ticks : nullptr;
+
+        for (int start = 0; start < num_samples; start += chunk_size)
+        {
+            const int len = juce::jmin(chunk_size, num_samples - start);
+            for (int active = 0; active < num_active_voices_; ++active)
+            {
+                renderVoice(active_voices_[active], voice_out, len, timing);
+                juce::FloatVectorOperations::add(mono_out + start,
+                                                 voice_out,
+                                                 len);
+            }
+        }
+
+        addEnvelopeTicks(envelope_ticks);
+        finishBlock();
+    }
+
+    /**
+    Overwrites dst with the next num_samples of one voice, envelope applied.
+    Different voices may be rendered concurrently from different threads.
+    If envelope_ticks is given, the time spent on the envelope is added to
+    it; the caller publishes the total with addEnvelopeTicks().
+    */
+    void renderVoice(int voice,
+                     float* dst,
+                     int num_samples,
+                     juce::int64* envelope_ticks = nullptr) noexcept
+    {
+        updatePitch(voice, num_samples);
+
+        if (cache_len_[voice] > 0 && cloud_.isEnabled())
+            leavePeriodCache(voice);
+
+        if (cloud_.isEnabled())
+        {
+            // Reading the table at note / grain frequency plays it at pitch
+            juce::FloatVectorOperations::clear(dst, num_samples);
+            dropped_grains_[voice] += cloud_.render(voice, dst, num_samples,
+                                                    grain_source_, table_size_,
+                                                    table_size_ / (2.0f * trigger_samples_[voice]));
+        }
+        else if (cache_len_[voice] > 0)
+        {
+            renderFromPeriodCache(voice, dst, num_samples);
+        }
+        else
+        {
+            juce::FloatVectorOperations::clear(dst, num_samples);
+            renderGrains(voice, dst, num_samples);
+
+            // Once every grain in flight was spawned at the current pitch,
+            // the grain pattern repeats and can be cached
+            samples_since_retune_[voice] += num_samples;
+            if (has_period_cache_ && samples_since_retune_[voice] >= table_size_)
+                enterPeriodCache(voice);
+        }
+
+        // The envelope goes through a stack buffer so voices rendered on
+        // different threads share nothing
+        const auto envelope_start = envelope_ticks != nullptr
+            ? juce::Time::getHighResolutionTicks() : 0;
+        float envelope[kEnvelopeChunkSize];
+        auto& adsr = adsr_[voice];
+        const float amp = amp_[voice];
+        for (int start = 0; start < num_samples; start += kEnvelopeChunkSize)
+        {
+            const int len = juce::jmin(kEnvelopeChunkSize, num_samples - start);
+            adsr.renderBlock(envelope, len);
+            juce::FloatVectorOperations::multiply(envelope, amp, len);
+            juce::FloatVectorOperations::multiply(dst + start, envelope, len);
+        }
+        if (envelope_ticks != nullptr)
+            *envelope_ticks += juce::Time::getHighResolutionTicks() - envelope_start;
+    }
+
+    /**
+    Publishes per-block statistics and drops voices whose envelope has
+    finished from the active list. Voices flagged in skip_voices are still
+    being rendered elsewhere and are left alone.
+    */
+    void finishBlock(const juce::uint8* skip_voices = nullptr) noexcept
+    {
+        publishOverlapStats(skip_voices);
+        removeFinishedVoices(skip_voices);
+    }
+
+    /**
+    Envelope timing costs two clock reads per voice, so it is off unless
+    something reads the ticks.
+    */
+    void setEnvelopeTimingEnabled(bool enabled) noexcept
+    {
+        envelope_timing_enabled_.store(enabled, std::memory_order_relaxed);
+    }
+
+    bool isEnvelopeTimingEnabled() const noexcept
+    {
+        return envelope_timing_enabled_.load(std::memory_order_relaxed);
+    }
+
+    /**
+    Adds envelope time a thread gathered over several renderVoice() calls.
+    */
+    void addEnvelopeTicks(juce::int64 ticks) noexcept
+    {
+        if (ticks != 0)
+            envelope_ticks_.fetch_add(ticks, std::memory_order_relaxed);
+    }
+
+    /**
+    Time spent applying envelopes since the last call, in high resolution
+    ticks, summed over every thread that rendered voices.
+    */
+    juce::int64 takeEnvelopeTicks() noexcept
+    {
+        return envelope_ticks_.exchange(0, std::memory_order_relaxed);
+    }
+
+    /**
+    The voices that are currently sounding, in render order.
+    */
+    const int* getActiveVoices() const noexcept
+    {
+        return active_voices_;
+    }
+
+    /**
+    Passes every voice whose envelope finished in the last block rendered
+    to callback, then forgets them. Audio thread only.
+    */
+    template <typename Callback>
+    void takeFinishedVoices(Callback&& callback) noexcept
+    {
+        for (int idx = 0; idx < num_finished_voices_; ++idx)
+            callback(finished_voices_[idx]);
+        num_finished_voices_ = 0;
+    }
+
+private:
+    /**
+    pool_size must be a power of two. Restarts every voice's grains.
+    */
+    void setGrainPoolSize(int pool_size)
+    {
+        grain_pool_size_ = pool_size;
+        grain_idx_mask_ = grain_pool_size_ - 1;
+
+        grain_idx_ringbuf_.assign(num_voices_ * grain_pool_size_, 0);
+        grain_data_ringbuf_.assign(num_voices_ * grain_pool_size_, grain_data_);
+        for (int voice = 0; voice < num_voices_; ++voice)
+        {
+            gidx_start_[voice] = 0;
+            curr_num_grains_[voice] = 1;
+            cache_len_[voice] = 0;
+            samples_since_retune_[voice] = 0;
+        }
+    }
+
+    /**
+    Points every per-voice array into the block at base, each starting on
+    its own cache line, and returns the bytes they take. With a null base
+    it only counts.
+    */
+    size_t layOutVoiceStorage(char* base) noexcept
+    {
+        size_t size = 0;
+        auto place = [&](auto*& array, int count)
+        {
+            size = (size + kStorageAlignment - 1) & ~(size_t) (kStorageAlignment - 1);
+            if (base != nullptr)
+                array = reinterpret_cast<std::remove_reference_t<decltype(array)>>(base + size);
+            size += (size_t) count * sizeof(*array);
+        };
+
+        place(pitch_, num_voices_);
+        place(target_pitch_, num_voices_);
+        place(pitch_bend_, num_voices_);
+        place(trigger_samples_, num_voices_);
+        place(accumulator_, num_voices_);
+        place(amp_, num_voices_);
+        place(gidx_start_, num_voices_);
+        place(curr_num_grains_, num_voices_);
+        place(peak_num_grains_, num_voices_);
+        place(dropped_grains_, num_voices_);
+        place(active_voices_, num_voices_);
+        place(is_voice_listed_, num_voices_);
+        place(finished_voices_, num_voices_);
+        place(samples_since_retune_, num_voices_);
+        place(cache_len_, num_voices_);
+        place(cache_periods_, num_voices_);
+        place(cache_phase_, num_voices_);
+        if (has_period_cache_)
+            place(period_cache_, num_voices_ * kMaxCacheSamples);
+        return size;
+    }
+
+    float calcTriggerSamples(float pitch) const noexcept
+    {
+        const float frequency = 440.0f * std::exp2((pitch - 69.0f) / 12.0f);
+        return (float) table_size_ * grain_freq_ / (2 * frequency);
+    }
+
+    /**
+    Moves a voice's pitch one block along its glide and retunes the grain
+    trigger interval if the pitch or bend changed.
+    */
+    void updatePitch(int voice, int num_samples) noexcept
+    {
+        float& pitch = pitch_[voice];
+        const float target_pitch = target_pitch_[voice];
+
+        if (pitch != target_pitch)
+        {
+            const float glide_samples = glide_time_.load() * (float) sample_rate_;
+            if (glide_samples <= (float) num_samples)
+            {
+                pitch = target_pitch;
+            }
+            else
+            {
+                pitch += (target_pitch - pitch)
+                    * (1.0f - std::exp(-num_samples / glide_samples));
+                if (std::abs(target_pitch - pitch) < kPitchSnap)
+                    pitch = target_pitch;
+            }
+        }
+
+        const float trigger_samples =
+            calcTriggerSamples(pitch + pitch_bend_[voice]);
+        if (trigger_samples != trigger_samples_[voice])
+        {
+            leavePeriodCache(voice);
+            trigger_samples_[voice] = trigger_samples;
+        }
+    }
+
+    void publishOverlapStats(const juce::uint8* skip_voices) noexcept
+    {
+        int peak = overlap_peak_.load(std::memory_order_relaxed);
+        int dropped = 0;
+        for (int active = 0; active < num_active_voices_; ++active)
+        {
+            int voice = active_voices_[active];
+            if (skip_voices != nullptr && skip_voices[voice])
+                continue;
+            peak = juce::jmax(peak, peak_num_grains_[voice]);
+            dropped += dropped_grains_[voice];
+            dropped_grains_[voice] = 0;
+        }
+        overlap_peak_.store(peak, std::memory_order_relaxed);
+        if (dropped > 0)
+            overlap_dropped_.fetch_add(dropped, std::memory_order_relaxed);
+    }
+
+    void removeFinishedVoices(const juce::uint8* skip_voices) noexcept
+    {
+        num_finished_voices_ = 0;
+        for (int active = num_active_voices_ - 1; active >= 0; --active)
+        {
+            int voice = active_voices_[active];
+            if (skip_voices != nullptr && skip_voices[voice])
+                continue;
+            if (!adsr_[voice].isActive())
+            {
+                finished_voices_[num_finished_voices_++] = voice;
+                is_voice_listed_[voice] = 0;
+                active_voices_[active] = active_voices_[--num_active_voices_];
+                active_voices_[num_active_voices_] = -1;
+            }
+        }
+    }
+
+    //==========================================================================
+    // Period cache
+
+    /**
+    Renders one cycle of the voice's steady-state grain pattern into its
+    cache. A cycle is the shortest whole number of samples holding
+    cache_periods_ grain onsets with at most kMaxCacheDetune error. Leaves
+    the voice uncached if no such cycle fits in kMaxCacheSamples.
+    */
+    void enterPeriodCache(int voice) noexcept
+    {
+        const float trigger_samples = trigger_samples_[voice];
+        if (curr_num_grains_[voice] == 0 || trigger_samples < 1.0f)
+            return;
+
+        int cycle_len = 0;
+        int cycle_periods = 0;
+        for (int periods = 1; periods <= kMaxCachePeriods; ++periods)
+        {
+            float exact_len = trigger_samples * periods;
+            int len = juce::roundToInt(exact_len);
+            if (len > kMaxCacheSamples)
+                break;
+            if (std::abs(len - exact_len) <= kMaxCacheDetune * exact_len)
+            {
+                cycle_len = len;
+                cycle_periods = periods;
+                break;
+            }
+        }
+        if (cycle_len == 0)
+            return;
+
+        float* cache = period_cache_ + voice * kMaxCacheSamples;
+        juce::FloatVectorOperations::clear(cache, cycle_len);
+
+        // Wrap every onset's grain around the cycle
+        auto* grain_readptr = grain_data_;
+        for (int period = 0; period < cycle_periods; ++period)
+        {
+            int dst_idx = period * cycle_len / cycle_periods;
+            int src_idx = 0;
+            while (src_idx < table_size_)
+            {
+                int len = juce::jmin(table_size_ - src_idx,
+                                     cycle_len - dst_idx);
+                juce::FloatVectorOperations::add(cache + dst_idx,
+                                                 grain_readptr + src_idx,
+                                                 len);
+                src_idx += len;
+                dst_idx = 0;
+            }
+        }
+
+        // The newest grain lines up with the first onset of the cycle
+        int* ringbuf = grain_idx_ringbuf_.data() + voice * grain_pool_size_;
+        int newest = (gidx_start_[voice] + curr_num_grains_[voice] - 1)
+                     & grain_idx_mask_;
+        cache_phase_[voice] = ringbuf[newest] % cycle_len;
+        cache_periods_[voice] = cycle_periods;
+        cache_len_[voice] = cycle_len;
+    }
+
+    void renderFromPeriodCache(int voice, float* dst, int num_samples) noexcept
+    {
+        const float* cache = period_cache_ + voice * kMaxCacheSamples;
+        const int cycle_len = cache_len_[voice];
+        int& phase = cache_phase_[voice];
+
+        int done = 0;
+        while (done < num_samples)
+        {
+            int len = juce::jmin(num_samples - done, cycle_len - phase);
+            juce::FloatVectorOperations::copy(dst + done, cache + phase, len);
+            done += len;
+            phase += len;
+            if (phase == cycle_len)
+                phase = 0;
+        }
+    }
+
+    /**
+    Rebuilds the grain ring buffer from the cache phase so live rendering
+    carries on from where playback of the cache stopped.
+    */
+    void leavePeriodCache(int voice) noexcept
+    {
+        samples_since_retune_[voice] = 0;
+
+        const int cycle_len = cache_len_[voice];
+        if (cycle_len == 0)
+            return;
+
+        const int cycle_periods = cache_periods_[voice];
+        const int phase = cache_phase_[voice];
+        int* ringbuf = grain_idx_ringbuf_.data() + voice * grain_pool_size_;
+        const float** data_ringbuf = grain_data_ringbuf_.data() + voice * grain_pool_size_;
+        int num_grains = 0;
+        int newest_age = table_size_;
+
+        for (int period = 0; period < cycle_periods; ++period)
+        {
+            int onset = period * cycle_len / cycle_periods;
+            int age = (phase - onset + cycle_len) % cycle_len;
+            newest_age = juce::jmin(newest_age, age);
+            for (; age < table_size_ && num_grains < grain_pool_size_;
+                 age += cycle_len)
+            {
+                // Insertion sort, oldest grain first
+                int slot = num_grains++;
+                while (slot > 0 && ringbuf[slot - 1] < age)
+                {
+                    ringbuf[slot] = ringbuf[slot - 1];
+                    --slot;
+                }
+                ringbuf[slot] = age;
+                data_ringbuf[slot] = grain_data_;
+            }
+        }
+
+        gidx_start_[voice] = 0;
+        curr_num_grains_[voice] = num_grains;
+        accumulator_[voice] = (float) newest_age;
+        cache_len_[voice] = 0;
+    }
+
+    /**
+    Adds the next num_samples of one voice's overlapping grains into dst.
+
+    All grain onsets in the block are found first, then each grain adds its
+    contiguous slice of the table in one vectorized pass.
+    */
+    void renderGrains(int voice, float* dst, int num_samples) noexcept
+    {
+        int* ringbuf = grain_idx_ringbuf_.data() + voice * grain_pool_size_;
+        const float** data_ringbuf = grain_data_ringbuf_.data() + voice * grain_pool_size_;
+        int& gidx_start = gidx_start_[voice];
+        int& curr_num_grains = curr_num_grains_[voice];
+        float& accumulator = accumulator_[voice];
+        const float trigger_samples = trigger_samples_[voice];
+
+        // A grain spawned at offset o in this block gets position -o, so it
+        // starts reading the table at dst[o]
+        int offset = 0;
+        while (offset < num_samples)
+        {
+            if (accumulator > trigger_samples)
+            {
+                if (curr_num_grains == grain_pool_size_)
+                {
+                    // Pool is full, so make room by retiring the oldest
+                    // grain; it is furthest into the tail of its window
+                    gidx_start = (gidx_start + 1) & grain_idx_mask_;
+                    --curr_num_grains;
+                    ++dropped_grains_[voice];
+                }
+                const int slot = (gidx_start + curr_num_grains) & grain_idx_mask_;
+                ringbuf[slot] = -offset;
+                data_ringbuf[slot] = grain_data_;
+                ++curr_num_grains;
+                accumulator -= trigger_samples;
+                accumulator += 1.0f;
+                ++offset;
+            }
+            else
+            {
+                // Skip straight to the sample where the next grain is due
+                int wait = (int) (trigger_samples - accumulator) + 1;
+                wait = juce::jmin(wait, num_samples - offset);
+                accumulator += (float) wait;
+                offset += wait;
+            }
+        }
+
+        peak_num_grains_[voice] = juce::jmax(peak_num_grains_[voice],
+                                             curr_num_grains);
+
+        for (int grain = 0; grain < curr_num_grains; ++grain)
+        {
+            const int slot = (gidx_start + grain) & grain_idx_mask_;
+            int& grain_idx = ringbuf[slot];
+            int dst_start = juce::jmax(0, -grain_idx);
+            int src_start = juce::jmax(0, grain_idx);
+            int len = juce::jmin(num_samples - dst_start,
+                                 table_size_ - src_start);
+            if (len > 0)
+            {
+                juce::FloatVectorOperations::add(dst + dst_start,
+                                                 data_ringbuf[slot] + src_start,
+                                                 len);
+            }
+            grain_idx += num_samples;
+        }
+
+        // Grains all have the same length, so the expired ones are always
+        // at the head of the ring buffer
+        while (curr_num_grains > 0 && ringbuf[gidx_start] >= table_size_)
+        {
+            ringbuf[gidx_start] = 0;
+            gidx_start = (gidx_start + 1) & grain_idx_mask_;
+            --curr_num_grains;
+        }
+    }
+
+    static const int kDefaultBlockSize = 512;
+    static const int kEnvelopeChunkSize = 256;
+    static constexpr float kPitchSnap = 0.001f; // semitones
+    static const int kDefaultGrainPoolSize = 64;
+    static const int kMinGrainPoolSize = 8;
+
+    // Begin grain data
+    GrainTable::Ptr grain_; // shared, never written
+    const float* grain_data_; // samples new grains read, grain_'s unless live
+    const float* grain_source_; // grain_data_ unwindowed, for grain clouds
+    int table_size_;
+    float grain_freq_;
+    double sample_rate_ = 48000.0;
+    // End grain data
+
+    Origin origin_;
+
+    // Begin per-voice state, indexed by voice. Arrays held by pointer live
+    // in voice_storage_.
+    static const int kStorageAlignment = 64; // bytes
+    int num_voices_;
+    juce::HeapBlock<char> voice_storage_;
+    float* pitch_ = nullptr; // MIDI note number, fractional
+    float* target_pitch_ = nullptr;
+    float* pitch_bend_ = nullptr; // semitones
+    std::atomic<float> glide_time_ { 0.0f }; // seconds
+    float* trigger_samples_ = nullptr;
+    float* accumulator_ = nullptr;
+    float* amp_ = nullptr;
+
+    int grain_pool_size_ = kDefaultGrainPoolSize; // a power of two
+    int grain_idx_mask_ = kDefaultGrainPoolSize - 1;
+    int* gidx_start_ = nullptr;
+    int* curr_num_grains_ = nullptr;
+    std::vector<int> grain_idx_ringbuf_; // grain_pool_size_ slots per voice
+    std::vector<const float*> grain_data_ringbuf_; // samples each grain reads
+    int* peak_num_grains_ = nullptr;
+    int* dropped_grains_ = nullptr; // since the last publishOverlapStats
+    std::atomic<int> overlap_peak_ { 0 };
+    std::atomic<int> overlap_dropped_ { 0 };
+
+    CustomADSR::Parameters adsr_parameters_;
+    std::vector<CustomADSR> adsr_;
+    std::atomic<bool> envelope_timing_enabled_ { false };
+    std::atomic<juce::int64> envelope_ticks_ { 0 }; // added to once per job
+    GrainCloud cloud_;
+    // End per-voice state
+
+    // Voices that are currently sounding; only these get rendered
+    int* active_voices_ = nullptr;
+    juce::uint8* is_voice_listed_ = nullptr;
+    int num_active_voices_ = 0;
+    int* finished_voices_ = nullptr; // dropped from the list last block
+    int num_finished_voices_ = 0;
+
+    // Begin period cache, indexed by voice
+    static const int kMaxCacheSamples = 8192;
+    static const int kMaxCachePeriods = 16;
+    static constexpr float kMaxCacheDetune = 0.0003f; // about half a cent
+    const bool has_period_cache_;
+    int* samples_since_retune_ = nullptr;
+    int* cache_len_ = nullptr; // 0 when rendering live
+    int* cache_periods_ = nullptr;
+    int* cache_phase_ = nullptr;
+    float* period_cache_ = nullptr; // kMaxCacheSamples per voice, if any
+    // End period cache
+
+    juce::AudioSampleBuffer voice_buffer_; // scratch shared by all voices
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (VoiceBank)
+};
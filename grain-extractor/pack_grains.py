@@ -0,0 +1,111 @@
+"""Packs a folder of grain WAVs into one memory-mappable grain bank.
+
+Grain files are named <name>.<base frequency>.wav, as make_grains.py writes
+them. Each grain is Hann-windowed here, the same way the synth windows a WAV
+it loads, so the synth can play the packed samples as they are. The samples
+before windowing follow, for grain clouds to read.
+
+Usage: python pack_grains.py <grains folder> <output.grainbank>
+
+The layout must match Source/GrainBank.h.
+"""
+import os
+import struct
+import sys
+
+import numpy as np
+import scipy.io.wavfile
+
+MAGIC = b"GRNB"
+VERSION = 2
+HEADER_FORMAT = "<4sIII"
+ENTRY_FORMAT = "<40sffIIQ"
+ALIGNMENT = 64  # bytes, GrainTable::kAlignment
+PADDING = 16  # zero samples after each grain, GrainTable::kPadding
+
+
+def parse_grain_name(filename):
+    """Splits <name>.<freq>...wav into its name and base frequency."""
+    parts = filename[:-len(".wav")].split(".", 1)
+    if len(parts) != 2:
+        return None
+    freq_str = parts[1].rstrip(".")
+    try:
+        return parts[0], float(freq_str)
+    except ValueError:
+        return None
+
+
+def hann(size):
+    """juce::dsp::WindowingFunction's Hann window, normalised to sum to size."""
+    window = 0.5 - 0.5 * np.cos(2.0 * np.pi * np.arange(size) / (size - 1))
+    return window * (size / window.sum())
+
+
+def to_float(data):
+    if data.ndim > 1:
+        data = data[:, 0]
+    if np.issubdtype(data.dtype, np.integer):
+        return data.astype(np.float32) / -np.iinfo(data.dtype).min
+    return data.astype(np.float32)
+
+
+def align(offset):
+    return (offset + ALIGNMENT - 1) // ALIGNMENT * ALIGNMENT
+
+
+def source_offset(num_samples):
+    """GrainTable::getSourceOffset, in bytes: where the unwindowed copy starts."""
+    return align(4 * (num_samples + PADDING))
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(__doc__)
+        sys.exit(1)
+
+    grains_folder, output_path = sys.argv[1], sys.argv[2]
+
+    grains = []
+    for filename in sorted(os.listdir(grains_folder)):
+        if not filename.endswith(".wav"):
+            continue
+        parsed = parse_grain_name(filename)
+        if parsed is None:
+            print(f"Skipping {filename}: no base frequency in its name")
+            continue
+
+        sr, data = scipy.io.wavfile.read(os.path.join(grains_folder, filename))
+        samples = to_float(data)
+        grains.append((parsed[0], parsed[1], sr, samples))
+
+    header_size = struct.calcsize(HEADER_FORMAT)
+    entry_size = struct.calcsize(ENTRY_FORMAT)
+
+    offset = align(header_size + entry_size * len(grains))
+    index, offsets = [], []
+    for name, freq, sr, samples in grains:
+        offsets.append(offset)
+        index.append(struct.pack(ENTRY_FORMAT, name.encode("utf-8")[:40],
+                                 freq, sr, len(samples), 0, offset))
+        offset = align(offset + source_offset(len(samples))
+                       + 4 * (len(samples) + PADDING))
+
+    with open(output_path, "wb") as out:
+        out.write(struct.pack(HEADER_FORMAT, MAGIC, VERSION, len(grains),
+                              entry_size))
+        out.write(b"".join(index))
+        for data_offset, (_, _, _, samples) in zip(offsets, grains):
+            windowed = samples * hann(len(samples))
+            out.write(b"\0" * (data_offset - out.tell()))
+            out.write(windowed.astype("<f4").tobytes())
+            out.write(b"\0" * (data_offset + source_offset(len(samples)) - out.tell()))
+            out.write(samples.astype("<f4").tobytes())
+            out.write(b"\0" * (4 * PADDING))
+        out.write(b"\0" * (offset - out.tell()))
+
+    print(f"Packed {len(grains)} grains into {output_path}")
+
+
+if __name__ == "__main__":
+    main()